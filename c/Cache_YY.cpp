@@ -0,0 +1,375 @@
+//==========================================================================================================================
+//										NOW THE SECTOR CACHE STUFF
+//==========================================================================================================================
+
+#include <cstdio>
+#include <cstdint>
+#include <cassert>
+#include <inttypes.h>		// see: https://en.cppreference.com/w/cpp/types/integer for printf'ing silly things
+#include "FAT_OS.h"		// <windows.h> or the bits of it we need
+
+#include "FAT_XX.h"
+#include "FAT_YY.h"
+
+//=================================================================================================
+//
+// This file provides a write-back cache of sectors that sits between the YY_ layer and the
+// XX_ReadSector()/XX_WriteSector() hardware calls. Everybody (FAT, directories and files)
+// gets their sectors from here so two handles looking at the same sector share one copy
+// and only the first look costs a device read.
+//
+// YY_GetSector() returns a pointer to the cached sector and 'pins' it so it will not be
+// recycled until the matching YY_ReleaseSector(). Pass bDirty to the release if you wrote
+// into it and it will be written back when recycled or on YY_FlushCache().
+//
+// The memory budget is fixed at N_CACHE_BLOCKS sectors and the least recently used unpinned
+// block is the one that gets recycled.
+//
+// If the device is memory mapped (XX_MapSector() says where) we lend out the mapped sector and
+// don't use a block at all. The pin and dirty calls are still made so nobody needs to know.
+//
+// With YY_THREADS the blocks and the hash table are behind cacheLock but it is let go while a
+// device transfers so one thread's miss doesn't hold up everyone else's hits. A block being read
+// is hooked in, pinned and marked loading and anyone else wanting that sector waits for it.
+//
+//=================================================================================================
+
+struct YY_BLOCK {
+	HANDLE		hDevice{};						// device and sector are the key, nullptr is free
+	uint32_t	sector{};
+	uint8_t		pins{};							// number of users, can't be recycled if not zero
+	uint8_t		dirty{};						// needs writing back to the device
+	uint8_t		loading{};						// being read with the lock let go, wait for it
+	uint32_t	last_used{};					// LRU stamp from cache_clock
+	YY_BLOCK*	next{};							// hash chain
+	uint8_t		data[512]{};					// the sector
+};
+
+static YY_BLOCK		blocks[N_CACHE_BLOCKS]{};
+static YY_BLOCK*	hashTable[N_CACHE_HASH]{};	// heads of the hash chains
+static uint32_t		cache_clock{};
+static uint32_t		cache_hits{}, cache_misses{};
+static XX_LOCK		cacheLock = XX_LOCK_INIT;	// all of the above
+
+static uint16_t hash(HANDLE hDevice, uint32_t sector)
+{
+	return (sector ^ (uint32_t)(uintptr_t)hDevice) % N_CACHE_HASH;
+}
+static YY_BLOCK* findBlock(HANDLE hDevice, uint32_t sector)
+{
+	for(YY_BLOCK* b = hashTable[hash(hDevice, sector)]; b; b=b->next)
+		if(b->sector==sector && b->hDevice==hDevice)
+			return b;
+	return nullptr;
+}
+static void unhook(YY_BLOCK* b)
+{
+	YY_BLOCK** p = &hashTable[hash(b->hDevice, b->sector)];
+	while(*p!=b) p = &(*p)->next;
+	*p = b->next;
+	b->next = nullptr;
+	b->hDevice = nullptr;
+}
+static bool writeBack(YY_BLOCK* b)
+{
+	if(b->dirty){
+		if(!XX_WriteSector(b->hDevice, b->sector, b->data)) return false;
+		b->dirty = false;
+	}
+	return true;
+}
+static void hook(YY_BLOCK* b, HANDLE hDevice, uint32_t sector)
+{
+	b->hDevice = hDevice;
+	b->sector  = sector;
+	b->dirty   = false;
+	uint16_t h = hash(hDevice, sector);
+	b->next = hashTable[h];
+	hashTable[h] = b;
+}
+// find a block to reuse, a free one or the least recently used unpinned one
+static YY_BLOCK* recycle()
+{
+	YY_BLOCK* oldest = nullptr;
+	for(int i=0; i<N_CACHE_BLOCKS; ++i){
+		YY_BLOCK* b = &blocks[i];
+		if(b->hDevice==nullptr && b->pins==0)		// unhooked but still pinned is a failed load
+			return b;
+		if(b->pins==0 && (oldest==nullptr || b->last_used < oldest->last_used))
+			oldest = b;
+	}
+	if(oldest==nullptr) return nullptr;			// everything is pinned
+	if(!writeBack(oldest)) return nullptr;
+	unhook(oldest);
+	return oldest;
+}
+// Wait (with cacheLock) for another thread's read into a block we have pinned to finish
+// false if it failed, in which case our pin is let go too
+static bool waitLoaded(YY_BLOCK* b)
+{
+	while(b->loading){
+		YY_Unlock(&cacheLock);
+		XX_Yield();
+		YY_Lock(&cacheLock);
+	}
+	if(b->hDevice!=nullptr) return true;
+	--b->pins;
+	return false;
+}
+// a block we can copy from now, one still loading might as well be read again
+static YY_BLOCK* loadedBlock(HANDLE hDevice, uint32_t sector)
+{
+	YY_BLOCK* b = findBlock(hDevice, sector);
+	return b && !b->loading ? b : nullptr;
+}
+//-------------------------------------------------------------------------------------------------
+// Pin a sector in the cache and return a pointer to its data
+// Use bRead=false if you are going to overwrite the whole sector so we need not read it first
+//-------------------------------------------------------------------------------------------------
+uint8_t* YY_GetSector(HANDLE hDevice, uint32_t sector, bool bRead)
+{
+	uint8_t* mapped = XX_MapSector(hDevice, sector);
+	YY_Lock(&cacheLock);
+	if(mapped){
+		++cache_hits;
+		YY_Unlock(&cacheLock);
+		return mapped;
+	}
+	YY_BLOCK* b = findBlock(hDevice, sector);
+	if(b){
+		++cache_hits;
+		++b->pins;
+		b->last_used = ++cache_clock;
+		if(b->loading && !waitLoaded(b)) b = nullptr;
+		YY_Unlock(&cacheLock);
+		return b ? b->data : nullptr;
+	}
+	b = recycle();
+	if(b==nullptr){
+		YY_Unlock(&cacheLock);
+		return nullptr;
+	}
+	hook(b, hDevice, sector);
+	++b->pins;
+	b->last_used = ++cache_clock;
+	++cache_misses;
+	if(bRead){
+		b->loading = true;
+		YY_Unlock(&cacheLock);
+		bool ok = XX_ReadSector(hDevice, sector, b->data);
+		YY_Lock(&cacheLock);
+		b->loading = false;
+		if(!ok){
+			--b->pins;
+			unhook(b);							// and anyone waiting for it sees that
+			b = nullptr;
+		}
+	}
+	YY_Unlock(&cacheLock);
+	return b ? b->data : nullptr;
+}
+// Unpin a sector, if you wrote to it say so
+void YY_ReleaseSector(void* buffer, bool bDirty)
+{
+	if(buffer==nullptr) return;
+	if((uint8_t*)buffer<blocks[0].data || (uint8_t*)buffer>blocks[N_CACHE_BLOCKS-1].data) return;	// a mapped sector
+	YY_BLOCK* b = &blocks[((uint8_t*)buffer - blocks[0].data) / sizeof(YY_BLOCK)];
+	YY_Lock(&cacheLock);
+	assert(b->data==buffer && b->pins);
+	if(bDirty) b->dirty = true;
+	--b->pins;
+	YY_Unlock(&cacheLock);
+}
+// Copy a sector out of the cache
+// bKeep=false is for streaming reads that would only push everything else out so if it isn't
+// already here just read it straight from the device
+bool YY_ReadSector(HANDLE hDevice, uint32_t sector, void* buffer, bool bKeep)
+{
+	if(!bKeep)
+		return YY_ReadSectors(hDevice, sector, 1, buffer);
+	uint8_t* data = YY_GetSector(hDevice, sector);
+	if(data==nullptr) return false;
+	memcpy(buffer, data, 512);
+	YY_ReleaseSector(data);
+	return true;
+}
+// Copy a sector into the cache, it gets to the device on recycle or flush
+bool YY_WriteSector(HANDLE hDevice, uint32_t sector, const void* buffer)
+{
+	uint8_t* data = YY_GetSector(hDevice, sector, false);
+	if(data==nullptr) return false;
+	memcpy(data, buffer, 512);
+	YY_ReleaseSector(data, true);
+	return true;
+}
+//-------------------------------------------------------------------------------------------------
+// Multi-sector versions so the device gets asked for runs of sectors in one go
+//-------------------------------------------------------------------------------------------------
+// Read consecutive sectors into a buffer without caching them (like bKeep=false)
+// anything we do have cached is copied from here as it might be newer than the device
+bool YY_ReadSectors(HANDLE hDevice, uint32_t sector, uint32_t count, void* buffer)
+{
+	uint8_t* out = (uint8_t*)buffer;
+	uint8_t* mapped = XX_MapSector(hDevice, sector);
+	if(mapped && XX_MapSector(hDevice, sector+count-1)){		// nothing is cached so just copy it
+		memcpy(out, mapped, count*512);
+		return true;
+	}
+	YY_Lock(&cacheLock);
+	while(count){
+		YY_BLOCK* b = loadedBlock(hDevice, sector);
+		uint16_t n = 1;
+		if(b){
+			++cache_hits;
+			memcpy(out, b->data, 512);
+		}
+		else{
+			while(n<count && n<XX_MAX_SECTORS && loadedBlock(hDevice, sector+n)==nullptr) ++n;	// how many aren't here
+			YY_Unlock(&cacheLock);
+			if(!(n==1 ? XX_ReadSector(hDevice, sector, out) : XX_ReadSectors(hDevice, sector, n, out)))
+				return false;
+			YY_Lock(&cacheLock);
+		}
+		sector += n;
+		count  -= n;
+		out	   += n*512;
+	}
+	YY_Unlock(&cacheLock);
+	return true;
+}
+// Write consecutive sectors straight to the device without caching them
+// anything we do have cached gets the new data too so it can't be written back over it later,
+// first, so nobody recycling an old dirty copy while we write can either
+bool YY_WriteSectors(HANDLE hDevice, uint32_t sector, uint32_t count, const void* buffer)
+{
+	const uint8_t* in = (const uint8_t*)buffer;
+	while(count){
+		uint16_t n = count>XX_MAX_SECTORS ? XX_MAX_SECTORS : (uint16_t)count;
+		bool bMapped = XX_MapSector(hDevice, sector)!=nullptr;
+		if(!bMapped){
+			YY_Lock(&cacheLock);
+			for(uint16_t i=0; i<n; ++i){
+				YY_BLOCK* b = findBlock(hDevice, sector+i);
+				if(b){
+					memcpy(b->data, in+i*512, 512);
+					b->dirty = false;
+				}
+			}
+			YY_Unlock(&cacheLock);
+		}
+		if(!(n==1 ? XX_WriteSector(hDevice, sector, (void*)in) : XX_WriteSectors(hDevice, sector, n, (void*)in))){
+			if(!bMapped){							// the cached copies are all there is now
+				YY_Lock(&cacheLock);
+				for(uint16_t i=0; i<n; ++i){
+					YY_BLOCK* b = findBlock(hDevice, sector+i);
+					if(b) b->dirty = true;
+				}
+				YY_Unlock(&cacheLock);
+			}
+			return false;
+		}
+		sector += n;
+		count  -= n;
+		in	   += n*512;
+	}
+	return true;
+}
+// Get the sectors we haven't got of a run into the cache with as few reads as possible
+// used where we expect to need them soon ie: the rest of a directory cluster
+void YY_PrefetchSectors(HANDLE hDevice, uint32_t sector, uint16_t count)
+{
+	if(XX_MapSector(hDevice, sector)) return;				// it's all here already
+	if(count>N_CACHE_BLOCKS/4) count = N_CACHE_BLOCKS/4;	// don't push everything else out
+	if(count>XX_MAX_SECTORS) count = XX_MAX_SECTORS;
+	YY_BLOCK* run[XX_MAX_SECTORS];
+	void* buffers[XX_MAX_SECTORS];
+	YY_Lock(&cacheLock);
+	while(count){
+		if(findBlock(hDevice, sector)){				// already have it (or someone is getting it)
+			++sector;
+			--count;
+			continue;
+		}
+		uint16_t n=0;
+		while(n<count && findBlock(hDevice, sector+n)==nullptr){
+			YY_BLOCK* b = recycle();
+			if(b==nullptr) break;					// all pinned
+			hook(b, hDevice, sector+n);				// hook it in and pin it so recycle() can't give it us again
+			++b->pins;
+			b->loading = true;
+			run[n] = b;
+			buffers[n++] = b->data;
+		}
+		if(n==0) break;
+		YY_Unlock(&cacheLock);
+		bool ok = XX_ReadSectorsV(hDevice, sector, n, buffers);
+		YY_Lock(&cacheLock);
+		for(uint16_t i=0; i<n; ++i){
+			run[i]->loading = false;
+			--run[i]->pins;
+			run[i]->last_used = ++cache_clock;
+			if(!ok) unhook(run[i]);
+		}
+		if(!ok) break;
+		cache_misses += n;
+		sector += n;
+		count  -= n;
+	}
+	YY_Unlock(&cacheLock);
+}
+// Write back everything dirty for a device in sector order and runs of consecutive sectors together
+// (this one holds cacheLock throughout, it's only the drive's writer that flushes)
+bool YY_FlushCache(HANDLE hDevice)
+{
+	YY_BLOCK* dirty[N_CACHE_BLOCKS];
+	uint16_t nDirty = 0;
+	YY_Lock(&cacheLock);
+	for(int i=0; i<N_CACHE_BLOCKS; ++i)
+		if(blocks[i].hDevice==hDevice && blocks[i].dirty){
+			uint16_t j = nDirty++;						// insertion sort by sector
+			while(j && dirty[j-1]->sector > blocks[i].sector){
+				dirty[j] = dirty[j-1];
+				--j;
+			}
+			dirty[j] = &blocks[i];
+		}
+
+	bool ret = true;
+	void* buffers[XX_MAX_SECTORS];
+	for(uint16_t i=0; i<nDirty; ){
+		uint16_t n=1;
+		while(i+n<nDirty && n<XX_MAX_SECTORS && dirty[i+n]->sector==dirty[i]->sector+n) ++n;
+		bool ok;
+		if(n==1)
+			ok = XX_WriteSector(hDevice, dirty[i]->sector, dirty[i]->data);
+		else{
+			for(uint16_t j=0; j<n; ++j)
+				buffers[j] = dirty[i+j]->data;
+			ok = XX_WriteSectorsV(hDevice, dirty[i]->sector, n, buffers);
+		}
+		for(uint16_t j=0; j<n; ++j)
+			if(ok) dirty[i+j]->dirty = false;
+		if(!ok) ret = false;
+		i += n;
+	}
+	YY_Unlock(&cacheLock);
+	return XX_FlushDevice(hDevice) && ret;
+}
+// Forget a device (ie: the media changed), anything dirty is lost
+void YY_InvalidateCache(HANDLE hDevice)
+{
+	YY_Lock(&cacheLock);
+	for(int i=0; i<N_CACHE_BLOCKS; ++i)
+		if(blocks[i].hDevice==hDevice && blocks[i].pins==0){
+			blocks[i].dirty = false;
+			unhook(&blocks[i]);
+		}
+	YY_Unlock(&cacheLock);
+}
+#if _DEBUG
+void CacheStats(uint32_t* hits, uint32_t* misses)
+{
+	*hits	= cache_hits;
+	*misses	= cache_misses;
+}
+#endif
@@ -2,8 +2,21 @@
 //										NOW THE CHARACTER SET STUFF
 //==========================================================================================================================
 
+#include <cstdint>
 #include <inttypes.h>
-//#include "FAT_YY.h"
+#include <cctype>
+#include "FAT_OS.h"
+#include "FAT_XX.h"
+#include "FAT_YY.h"
+
+// Names are nearly always plain ASCII so the transcoders copy runs of that 16 characters at a time
+// (SSE2, as the FAT scan kernels) or one at a time without decoding and only drop into the full
+// code point conversion for the rest. The SSE2 loads are aligned so they never cross into a page
+// past the terminator (though ASan can't know that so it gets the plain loops).
+#if YY_SIMD && !defined(__SANITIZE_ADDRESS__) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP>=2))
+#include <emmintrin.h>
+#define SIMD_SSE2
+#endif
 
 //================================================================================================================
 // Character functions
@@ -130,10 +143,54 @@ static int UnicodetoUTF8(uint8_t* text, uint16_t& index, uint16_t max, uint32_t
 // String functions
 //=================================================================================================
 
+//-------------------------------------------------------------------------------------------------
+// ASCII runs: copy from input[i] to output[n] while the characters are 1..0x7f and there is room
+// and return with i and n moved past what was done
+//-------------------------------------------------------------------------------------------------
+static void asciiToWide(uint16_t* output, uint16_t& n, uint16_t cbOut, const uint8_t* input, uint16_t& i, uint16_t cbIn)
+{
+#if defined(SIMD_SSE2)
+	while(((uintptr_t)(input+i) & 15) && i<cbIn && n<cbOut-1 && input[i] && input[i]<0x80)
+		output[n++] = input[i++];
+	__m128i zero = _mm_setzero_si128();
+	while(((uintptr_t)(input+i) & 15)==0 && cbIn-i>=16 && cbOut-1-n>=16){
+		__m128i x = _mm_load_si128((const __m128i*)(input+i));
+		if(_mm_movemask_epi8(x) | _mm_movemask_epi8(_mm_cmpeq_epi8(x, zero))) break;
+		_mm_storeu_si128((__m128i*)(output+n),	 _mm_unpacklo_epi8(x, zero));
+		_mm_storeu_si128((__m128i*)(output+n+8), _mm_unpackhi_epi8(x, zero));
+		i += 16;
+		n += 16;
+	}
+#endif
+	while(i<cbIn && n<cbOut-1 && input[i] && input[i]<0x80)
+		output[n++] = input[i++];
+}
+static void asciiToNarrow(uint8_t* output, uint16_t& n, uint16_t cbOut, const uint16_t* input, uint16_t& i, uint16_t cbIn)
+{
+#if defined(SIMD_SSE2)
+	while(((uintptr_t)(input+i) & 15) && i<cbIn && n<cbOut-1 && input[i] && input[i]<0x80)
+		output[n++] = (uint8_t)input[i++];
+	__m128i zero = _mm_setzero_si128();
+	while(((uintptr_t)(input+i) & 15)==0 && cbIn-i>=16 && cbOut-1-n>=16){
+		__m128i lo = _mm_load_si128((const __m128i*)(input+i));
+		__m128i hi = _mm_load_si128((const __m128i*)(input+i+8));
+		__m128i x  = _mm_packus_epi16(lo, hi);		// anything over 0x7f stays over 0x7f
+		if(_mm_movemask_epi8(x) | _mm_movemask_epi8(_mm_cmpeq_epi8(x, zero))) break;
+		_mm_storeu_si128((__m128i*)(output+n), x);
+		i += 16;
+		n += 16;
+	}
+#endif
+	while(i<cbIn && n<cbOut-1 && input[i] && input[i]<0x80)
+		output[n++] = (uint8_t)input[i++];
+}
+
 uint16_t*  YY_ToWide(uint16_t* output, uint16_t cbOut, const uint8_t* input, uint16_t cbIn)
 {
 	uint16_t i=0, n=0;
 	while(n<cbOut-1 && i<cbIn){
+		asciiToWide(output, n, cbOut, input, i, cbIn);
+		if(n>=cbOut-1 || i>=cbIn) break;
 		uint32_t c = UTF8toUnicode(input, i);
 		if(c==0 || UnicodetoUTF16(output, n, cbOut, c)==0) break;
 	}
@@ -144,9 +201,33 @@ uint8_t* YY_ToNarrow(uint8_t* output, uint16_t cbOut, const uint16_t* input, uin
 {
 	uint16_t i=0, n=0;
 	while(n<cbOut-1 && i<cbIn){
+		asciiToNarrow(output, n, cbOut, input, i, cbIn);
+		if(n>=cbOut-1 || i>=cbIn) break;
 		uint32_t c = UTF16toUnicode(input, i);
 		if(c==0 || UnicodetoUTF8(output, n, cbOut, c)==0) break;
 	}
 	output[n] = 0;
 	return output;
 }
+// fold case for name comparisons, only ASCII as that's all tolower() promises and doing it
+// ourselves keeps the locale lookup out of every character of every directory scan
+uint16_t YY_Fold(uint16_t c)
+{
+	return (uint16_t)(c-'A')<26 ? c+('a'-'A') : c;
+}
+// wchar_t is 32 bits outside Windows so we can't use the wcs*() functions on our uint16_t text
+uint16_t YY_WideLen(const uint16_t* text)
+{
+	uint16_t n=0;
+	while(text[n]) ++n;
+	return n;
+}
+// append src to dest (cbDest characters) and truncate if it doesn't fit
+uint16_t* YY_WideCat(uint16_t* dest, uint16_t cbDest, const uint16_t* src)
+{
+	uint16_t n = YY_WideLen(dest);
+	while(*src && n<cbDest-1)
+		dest[n++] = *src++;
+	dest[n] = 0;
+	return dest;
+}
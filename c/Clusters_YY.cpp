@@ -5,8 +5,9 @@
 #include <cstdio>
 #include <cstdint>
 #include <cassert>
+#include <cstring>
 #include <inttypes.h>		// see: https://en.cppreference.com/w/cpp/types/integer for printf'ing silly things
-#include <windows.h>
+#include "FAT_OS.h"		// <windows.h> or the bits of it we need
 
 #include "FAT_XX.h"
 #include "FAT_YY.h"
@@ -51,28 +52,129 @@ uint32_t YY_SectorToCluster(YY_DRIVE* drive, uint32_t s)	// cluster containing s
 //-------------------------------------------------------------------------------------------------
 // Cluster handling by FAT
 //-------------------------------------------------------------------------------------------------
-// I have a buffer in the YY_DRIVE to hold a 'current fat sector I'm working on' so I need to now
-// if I have written to it so I know to save it before I reuse the buffer for another cluster.
+// I have a few buffers in the YY_DRIVE each holding a 'fat sector I'm working on' so I need to know
+// if I have written to one so I know to save it before I reuse it for another sector.
+// When I need a new sector the least recently used buffer gets recycled.
+//
+// A recycled dirty buffer only goes as far as the first FAT in the sector cache and its number goes
+// in a sorted list. Writing every copy of the FAT each time a buffer was recycled made a long
+// allocation into a storm of single sector writes so instead YY_FlushFAT() (sync, close, unmount
+// or the list filling up) writes the listed sectors out in runs to all the copies at once.
 
-// Flush the FAT buffer to both FAT tables
-void YY_FlushFAT(YY_DRIVE* drive)
+// pack a sector's worth of the resident FAT12 back into 12 bit entries
+static void PackFat12(YY_DRIVE* drive, uint32_t fat_sector, uint8_t* out)
+{
+	for(uint16_t i=0; i<512; ++i){
+		uint32_t offset = fat_sector*512 + i;		// byte in the FAT
+		uint32_t pair	= offset/3;					// three bytes hold two entries
+		uint16_t e0 = pair*2   < drive->fat12Entries ? drive->fat12[pair*2]   : 0;	// the FAT can end part way
+		uint16_t e1 = pair*2+1 < drive->fat12Entries ? drive->fat12[pair*2+1] : 0;	// through a pair
+		switch(offset%3){
+		case 0:	out[i] = e0 & 0xff;						break;
+		case 1:	out[i] = (e0>>8) | ((e1 & 0xf)<<4);		break;
+		case 2:	out[i] = e1>>4;							break;
+		}
+	}
+}
+// write the listed sectors to every copy of the FAT and empty the list
+static void WriteDirtyFat(YY_DRIVE* drive)
 {
-	if(drive->fat_dirty){
-		XX_WriteSector(drive->hDevice, drive->last_fat_sector + drive->fat_begin_sector,				 &drive->fatTable);
-		XX_WriteSector(drive->hDevice, drive->last_fat_sector + drive->fat_begin_sector+drive->fat_size, &drive->fatTable);
-		drive->fat_dirty = false;
+	uint8_t buffer[FATFLUSH_RUN*512];
+	uint16_t i = 0;
+	while(i<drive->nFatDirty){
+		uint32_t first = drive->fatDirty[i];
+		uint16_t n = 1;
+		while(i+n<drive->nFatDirty && n<FATFLUSH_RUN && drive->fatDirty[i+n]==first+n)	// coalesce a run
+			++n;
+		if(drive->fat12){
+			for(uint16_t j=0; j<n; ++j)
+				PackFat12(drive, first+j, buffer+j*512);
+		}
+		if(drive->fat12 || YY_ReadSectors(drive->hDevice, drive->fat_begin_sector+first, n, buffer)){	// from the cache
+			for(uint8_t copy=0; copy<drive->fat_copies; ++copy)
+				if(!YY_WriteSectors(drive->hDevice, drive->fat_begin_sector + copy*drive->fat_size + first, n, buffer))
+					printf("Failed to write FAT%u sector %u\n", copy+1, first);
+		}
+		else
+			printf("Failed to read back FAT sector %u\n", first);
+		i += n;
 	}
+	drive->nFatDirty = 0;
+}
+// add a FAT sector to the list
+static void MarkFatDirty(YY_DRIVE* drive, uint32_t fat_sector)
+{
+	uint16_t lo=0, hi=drive->nFatDirty;				// binary chop for where it goes
+	while(lo<hi){
+		uint16_t mid = (lo+hi)/2;
+		if(drive->fatDirty[mid] < fat_sector)
+			lo = mid+1;
+		else
+			hi = mid;
+	}
+	if(lo<drive->nFatDirty && drive->fatDirty[lo]==fat_sector) return;	// already there
+	if(drive->nFatDirty==N_FATDIRTY){				// full so get rid of them
+		WriteDirtyFat(drive);
+		lo = 0;
+	}
+	memmove(&drive->fatDirty[lo+1], &drive->fatDirty[lo], (drive->nFatDirty-lo)*sizeof(uint32_t));
+	drive->fatDirty[lo] = fat_sector;
+	++drive->nFatDirty;
+}
+// Put one FAT buffer into the first FAT (in the sector cache) and remember it needs copying
+static void FlushFatBuffer(YY_DRIVE* drive, YY_FATBUFFER* fb)
+{
+	if(fb->fat_dirty){
+		YY_WriteSector(drive->hDevice, fb->fat_sector + drive->fat_begin_sector, &fb->fatTable);
+		MarkFatDirty(drive, fb->fat_sector);
+		fb->fat_dirty = false;
+	}
+}
+// Flush all the FAT buffers and get them onto the device
+void YY_FlushFAT(YY_DRIVE* drive)
+{
+	for(int i=0; i<N_FATBUFFERS; ++i)
+		FlushFatBuffer(drive, &drive->fatBuffers[i]);
+	WriteDirtyFat(drive);
+	YY_UpdateFSInfo(drive);
+	YY_FlushCache(drive->hDevice);
 }
 // Read and cache a FAT sector
 static void* GetFatSector(YY_DRIVE* drive, uint32_t required_fat_sector)
 {
-	if(drive->last_fat_sector!=required_fat_sector){
-		YY_FlushFAT(drive);
-		XX_ReadSector(drive->hDevice, required_fat_sector + drive->fat_begin_sector, &drive->fatTable);	// read HW sector
-		drive->last_fat_sector = required_fat_sector;
-//		dump(fatTable, 512);
+	YY_FATBUFFER* fb = drive->fatCurrent;
+	if(fb->fat_sector!=required_fat_sector){			// not the one we used last time so search
+		YY_FATBUFFER* oldest = &drive->fatBuffers[0];
+		for(fb=drive->fatBuffers; fb<drive->fatBuffers+N_FATBUFFERS; ++fb){
+			if(fb->fat_sector==required_fat_sector)
+				break;
+			if(fb->last_used < oldest->last_used)
+				oldest = fb;
+		}
+		if(fb==drive->fatBuffers+N_FATBUFFERS){			// not cached so recycle the oldest
+			fb = oldest;
+			FlushFatBuffer(drive, fb);
+			fb->fat_sector = 0xffffffff;				// in case the read fails
+			if(YY_ReadSector(drive->hDevice, required_fat_sector + drive->fat_begin_sector, &fb->fatTable))	// read HW sector
+				fb->fat_sector = required_fat_sector;
+			++drive->fat_misses;
+//			dump(fb->fatTable, 512);
+		}
+		else
+			++drive->fat_hits;
+		drive->fatCurrent = fb;
 	}
-	return drive->fatTable;
+	else
+		++drive->fat_hits;
+	fb->last_used = ++drive->fat_clock;
+	return fb->fatTable;
+}
+static uint32_t* FreeWord(YY_DRIVE* drive, uint32_t word);
+
+// Mark the buffer from the last GetFatSector() as needing a write
+static void SetFatDirty(YY_DRIVE* drive)
+{
+	drive->fatCurrent->fat_dirty = true;
 }
 //-------------------------------------------------------------------------------------------------
 // First an explanation about how I handle FAT12 because it is the messy one to do fast and compact.
@@ -131,6 +233,9 @@ static void set12bitsA(uint8_t *array, uint16_t index, uint16_t value)
 // now use them to read a FAT12 and get an entry
 static uint32_t get12bitsFAT(YY_DRIVE* drive, uint16_t index)
 {
+	if(drive->fat12)						// easy if it's all in memory, off the end is a bad chain so stop it
+		return index<drive->fat12Entries ? drive->fat12[index] : 0xfff;
+
 	uint8_t triad = index/1024;				// which triad of sectors?
 	index %=  1024;							// index within that triad
 	if(index<341){														// 0-340 that's 170 pairs and the whole of 340 (even)
@@ -139,10 +244,11 @@ static uint32_t get12bitsFAT(YY_DRIVE* drive, uint16_t index)
 	}
 	else if(index==341){												// the last 4 bits of sector0 and the first 8 bits of sector1
 		uint8_t* array = (uint8_t*)GetFatSector(drive, triad*3+0);		// get the first sector of the triad
-		drive->fatPrefix = array[511];									// save the overlap byte in front of the buffer
+		uint8_t overlap = array[511];									// save the overlap byte
 		array = (uint8_t*)GetFatSector(drive, triad*3+1) - 2;			// get the second sector of the triad
 																		// set the array pointer 2 bytes before the actual sector
 																		// pointing to the pair 340/341 as 0/1
+		array[1] = overlap;												// put the overlap byte in the buffer's fatPrefix
 		return get12bitsA(array, 1);									// get the 'odd' member of a pair (we only need one byte as we never access 340=0
 	}
 	else if(index<682){													// 342-681 inclusive completely within the second sector
@@ -152,8 +258,9 @@ static uint32_t get12bitsFAT(YY_DRIVE* drive, uint16_t index)
 	}
 	else if(index==682){												// this time our overlap is a whole byte and an even item
 		uint8_t* array = (uint8_t*)GetFatSector(drive, triad*3+1);		// get the second sector of the triad
-		drive->fatPrefix = array[511];									// copy the byte
+		uint8_t overlap = array[511];									// copy the byte
 		array = (uint8_t*)GetFatSector(drive, triad*3+2) - 1;			// get the third sector of the triad offset the array down 1 to include the extra byte
+		array[0] = overlap;												// into the buffer's fatPrefix
 		return get12bitsA(array, 0);									// return the first item in the array
 	}
 	else{																// 683-1023 inclusive an odd byte and 170 pairs all completely within sector three
@@ -164,85 +271,419 @@ static uint32_t get12bitsFAT(YY_DRIVE* drive, uint16_t index)
 // as above but write an entry to the FAT12
 static void set12bitsFAT(YY_DRIVE* drive, uint16_t index, uint16_t value)
 {
+	if(drive->fat12){
+		if(index>=drive->fat12Entries) return;
+		drive->fat12[index] = value;
+		uint32_t offset = index*3/2;		// first byte it touches
+		MarkFatDirty(drive, offset/512);
+		MarkFatDirty(drive, (offset+1)/512);
+		return;
+	}
+
 	uint8_t triad = index/1024;				// which triad of sectors?
 	index %=  1024;							// index within that triad
 	if(index<341){														// 0-340 inclusive completely within the first sector...
 																		// that's 170 pairs and the 2 bytes left contain all of 340 and part of 341
 		uint8_t* array = (uint8_t*)GetFatSector(drive, triad*3+0);		// get the first sector of the triad
 		set12bitsA(array, index, value);
-		drive->fat_dirty;
+		SetFatDirty(drive);
 		return;
 	}
 	else if(index==341){												// divided the last 4 bits of sector 0 and the first 8 bits of sector1
 		uint8_t* array = (uint8_t*)GetFatSector(drive, triad*3+0);		// get the first sector of the triad
-		drive->fatPrefix = array[511];									// save the last byte of sector0 before sector1
 		set12bitsA(array, 341, value);									// write to sector0, spills a byte into fatSuffix
-		drive->fat_dirty = true;										// ensure the write
+		SetFatDirty(drive);												// ensure the write
 		array = (uint8_t*)GetFatSector(drive, triad*3+1) - 2;			// get the second sector of the triad
 		set12bitsA(array, 1, value);									// put the 'odd' member of a pair spills into fatPrefix
-		drive->fat_dirty;
+		SetFatDirty(drive);
 		return;
 	}
 	else if(index<682){													// 342-681 inclusive completely within second sector
 		uint8_t* array = (uint8_t*)GetFatSector(drive, triad*3+1) + 1;	// get the second sector of the triad
 		set12bitsA(array, index-342, value);
-		drive->fat_dirty;
+		SetFatDirty(drive);
 		return;
 	}
 	else if(index==682){
 		uint8_t* array = (uint8_t*)GetFatSector(drive, triad*3+1);		// get the second sector of the triad
-		set12bitsA(array, 341, value);
-		drive->fat_dirty = true;
+		array[511] = value & 0xff;										// the last byte is the low 8 bits
+		SetFatDirty(drive);
 		array = (uint8_t*)GetFatSector(drive, triad*3+2) - 1;			// get the third sector of the triad
 		set12bitsA(array, 0, value);									// spills into fatPrefix
-		drive->fat_dirty = true;
+		SetFatDirty(drive);
 		return;
 	}
 	else{																// 683-1023 inclusive completely within sector three
 		uint8_t* array = (uint8_t*)GetFatSector(drive, triad*3+2)-1;	// get the third sector of the triad
 		set12bitsA(array, index-682, value);							// 683->index 1 so we never need array[0]
-		drive->fat_dirty = true;
+		SetFatDirty(drive);
 		return;
 	}
 }
 //=================================================================================================
+// One engine per FAT type
+//=================================================================================================
+// Rather than ask drive->fat_type on every entry in every loop each FAT type has its own set of
+// routines and YY_SetFatOps() picks the set once at mount. In Z80 terms it's a jump table per drive.
+// run() is the one that earns its keep: it follows a chain for as long as each cluster just links
+// to the next one, a sector's worth at a time with no calls, so mapping a file written in one piece
+// costs a compare per cluster.
+
+static uint32_t get32(YY_DRIVE* drive, uint32_t cluster)
+{
+	return ((uint32_t*)GetFatSector(drive, cluster/128))[cluster%128] & 0x0fffffff;	// not the top 4 bits
+}
+static uint32_t set32(YY_DRIVE* drive, uint32_t cluster, uint32_t value)
+{
+	uint32_t* array = (uint32_t*)GetFatSector(drive, cluster/128);
+	uint32_t v = array[cluster%128];
+	uint32_t old = v & 0x0fffffff;
+	v &= 0xf0000000;									// preserve the top 4 bits
+	v |= value & 0x0fffffff;
+	array[cluster%128] = v;
+	SetFatDirty(drive);
+	return old;
+}
+static uint32_t run32(YY_DRIVE* drive, uint32_t cluster, uint32_t max)
+{
+	uint32_t n = 0;
+	while(n<max){
+		uint32_t* array = (uint32_t*)GetFatSector(drive, (cluster+n)/128);
+		uint16_t t = (cluster+n)%128;
+		while(t<128 && n<max && (array[t] & 0x0fffffff)==cluster+n+1){
+			++t;
+			++n;
+		}
+		if(t<128) break;								// the run stopped in this sector
+	}
+	return n;
+}
+static uint32_t get16(YY_DRIVE* drive, uint32_t cluster)
+{
+	return ((uint16_t*)GetFatSector(drive, cluster/256))[cluster%256];
+}
+static uint32_t set16(YY_DRIVE* drive, uint32_t cluster, uint32_t value)
+{
+	uint16_t* array = (uint16_t*)GetFatSector(drive, cluster/256);
+	uint32_t old = array[cluster%256];
+	array[cluster%256] = value & 0xffff;
+	SetFatDirty(drive);
+	return old;
+}
+static uint32_t run16(YY_DRIVE* drive, uint32_t cluster, uint32_t max)
+{
+	uint32_t n = 0;
+	while(n<max){
+		uint16_t* array = (uint16_t*)GetFatSector(drive, (cluster+n)/256);
+		uint16_t t = (cluster+n)%256;
+		while(t<256 && n<max && array[t]==cluster+n+1){
+			++t;
+			++n;
+		}
+		if(t<256) break;
+	}
+	return n;
+}
+static uint32_t get12(YY_DRIVE* drive, uint32_t cluster)
+{
+	return get12bitsFAT(drive, cluster);
+}
+static uint32_t set12(YY_DRIVE* drive, uint32_t cluster, uint32_t value)
+{
+	uint32_t old = get12bitsFAT(drive, cluster);
+	set12bitsFAT(drive, cluster, value & 0xfff);
+	return old;
+}
+static uint32_t run12(YY_DRIVE* drive, uint32_t cluster, uint32_t max)
+{
+	uint32_t n = 0;
+	if(drive->fat12)									// all in memory
+		while(n<max && cluster+n<drive->fat12Entries && drive->fat12[cluster+n]==cluster+n+1) ++n;
+	else
+		while(n<max && get12bitsFAT(drive, cluster+n)==cluster+n+1) ++n;
+	return n;
+}
+static const YY_FATOPS fatOps[] = {
+	//	get		set		run		bad			eoc
+	{ get12, set12, run12, 0xff7,		0xfff		},		// UNKNOWN_FAT, never used
+	{ get12, set12, run12, 0xff7,		0xfff		},		// FAT12
+	{ get16, set16, run16, 0xfff7,		0xffff		},		// FAT16
+	{ get32, set32, run32, 0xffffff7,	0x0fffffff	},		// FAT32
+};
+void YY_SetFatOps(YY_DRIVE* drive)
+{
+	drive->fatOps = &fatOps[drive->fat_type];
+}
+//=================================================================================================
 // Manage cluster entries for all FAT types
 //=================================================================================================
 // Get the FAT entry for a specific Cluster
-uint32_t YY_GetClusterEntry(YY_DRIVE* drive, uint32_t cluster)
+// Readers share the drive so these take its FAT lock as even reading shuffles the FAT buffers.
+// Anything that writes has the whole drive to itself and a loop can take the lock once itself so
+// both say bHeld (or in here just go straight to the fatOps) rather than pay for it every entry.
+uint32_t YY_GetClusterEntry(YY_DRIVE* drive, uint32_t cluster, bool bHeld)
 {
-	if(drive->fat_type==FAT32)
-		return ((uint32_t*)GetFatSector(drive, cluster/128))[cluster%128] & 0xfffffff;	// not the top 4 bits
-
-	if(drive->fat_type==FAT16)
-		return ((uint16_t*)GetFatSector(drive, cluster/256))[cluster%256];
-
-//	if(drive->fat_type==FAT12)						// implicit
-		return get12bitsFAT(drive, cluster);
+	if(bHeld) return drive->fatOps->get(drive, cluster);
+	YY_LockFat(drive);
+	uint32_t entry = drive->fatOps->get(drive, cluster);
+	YY_UnlockFat(drive);
+	return entry;
 }
 // As above but write the entry
 void YY_SetClusterEntry(YY_DRIVE* drive, uint32_t cluster, uint32_t value)
 {
-	if(drive->fat_type==FAT32){
-		uint32_t* array = (uint32_t*)GetFatSector(drive, cluster/128);
-		uint32_t v = array[cluster%128] & 0xf0000000;		// preserve the top 4 bits
-		v |= value & 0x0fffffff;
-		array[cluster%128] = v;
-		drive->fat_dirty = true;
-		return;
+	uint32_t old = drive->fatOps->set(drive, cluster, value);
+	// keep the free space book keeping in step
+	if((old==0) != (value==0)){
+		if(drive->free_clusters!=0xffffffff){
+			if(value==0) ++drive->free_clusters;
+			else		 --drive->free_clusters;
+		}
+		if(drive->freeMap){
+			uint32_t* w = FreeWord(drive, cluster/32);
+			if(value==0) *w |=  (1u<<(cluster%32));
+			else		 *w &= ~(1u<<(cluster%32));
+		}
 	}
+}
+//=================================================================================================
+// Free space
+//=================================================================================================
+// Scanning the FAT for a free entry gets painful on a big nearly full card so optionally (see
+// YY_FREEMAP) I build a bitmap of the free clusters when we mount, one bit per cluster set if it
+// is free, and YY_SetClusterEntry() keeps it in step. Finding space is then a search of 32 bits
+// at a time in memory. The bitmap is in pages because XX_alloc() only does 64K at a time.
 
-	if(drive->fat_type==FAT16){
-		uint16_t* array = (uint16_t*)GetFatSector(drive, cluster/256);
-		array[cluster%256] = value & 0xffff;
-		drive->fat_dirty = true;
-		return;
+static uint32_t* FreeWord(YY_DRIVE* drive, uint32_t word)
+{
+	return &drive->freeMap[word/FREEMAP_PAGE_WORDS][word%FREEMAP_PAGE_WORDS];
+}
+// lowest set bit in a non zero word
+static uint8_t LowestBit(uint32_t w)
+{
+#if defined(_MSC_VER)
+	unsigned long n;
+	_BitScanForward(&n, w);
+	return (uint8_t)n;
+#else
+	return (uint8_t)__builtin_ctz(w);
+#endif
+}
+//-------------------------------------------------------------------------------------------------
+// Scan kernels
+// Turn 32 FAT entries into a 32 bit mask, bit n set if entry n is free (or bad). With SSE2 or AVX2
+// that's a handful of compares and movemasks rather than 32 tests and branches so streaming the
+// whole FAT through at mount runs at the speed of the reads. Anything else gets the plain loop.
+//-------------------------------------------------------------------------------------------------
+#if YY_SIMD && defined(__AVX2__)
+#include <immintrin.h>
+#define SIMD_AVX2
+#elif YY_SIMD && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP>=2))
+#include <emmintrin.h>
+#define SIMD_SSE2
+#endif
+
+// the entries don't need to be aligned (the FAT buffers aren't)
+static uint32_t MatchBits32(const uint32_t* a, uint32_t value)
+{
+#if defined(SIMD_AVX2)
+	__m256i mask = _mm256_set1_epi32(0x0fffffff), v = _mm256_set1_epi32((int)value);
+	uint32_t bits = 0;
+	for(int i=0; i<32; i+=8){
+		__m256i x = _mm256_and_si256(_mm256_loadu_si256((const __m256i*)(a+i)), mask);
+		bits |= (uint32_t)_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(x, v))) << i;
+	}
+	return bits;
+#elif defined(SIMD_SSE2)
+	__m128i mask = _mm_set1_epi32(0x0fffffff), v = _mm_set1_epi32((int)value);
+	uint32_t bits = 0;
+	for(int i=0; i<32; i+=4){
+		__m128i x = _mm_and_si128(_mm_loadu_si128((const __m128i*)(a+i)), mask);
+		bits |= (uint32_t)_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(x, v))) << i;
+	}
+	return bits;
+#else
+	uint32_t bits = 0;
+	for(int i=0; i<32; ++i)
+		if((a[i] & 0x0fffffff)==value) bits |= 1u<<i;
+	return bits;
+#endif
+}
+static uint32_t MatchBits16(const uint16_t* a, uint16_t value)
+{
+#if defined(SIMD_AVX2)
+	__m256i v = _mm256_set1_epi16((short)value);
+	__m256i lo = _mm256_cmpeq_epi16(_mm256_loadu_si256((const __m256i*)a),	   v);
+	__m256i hi = _mm256_cmpeq_epi16(_mm256_loadu_si256((const __m256i*)(a+16)), v);
+	// packs works within 128 bit lanes so put the quarters back in order after
+	__m256i p = _mm256_permute4x64_epi64(_mm256_packs_epi16(lo, hi), 0xd8);
+	return (uint32_t)_mm256_movemask_epi8(p);
+#elif defined(SIMD_SSE2)
+	__m128i v = _mm_set1_epi16((short)value);
+	uint32_t bits = 0;
+	for(int i=0; i<32; i+=16){
+		__m128i lo = _mm_cmpeq_epi16(_mm_loadu_si128((const __m128i*)(a+i)),	v);
+		__m128i hi = _mm_cmpeq_epi16(_mm_loadu_si128((const __m128i*)(a+i+8)), v);
+		bits |= (uint32_t)_mm_movemask_epi8(_mm_packs_epi16(lo, hi)) << i;
 	}
-	if(drive->fat_type==FAT12){
-		set12bitsFAT(drive, cluster, value & 0xfff);
-		drive->fat_dirty = true;
+	return bits;
+#else
+	uint32_t bits = 0;
+	for(int i=0; i<32; ++i)
+		if(a[i]==value) bits |= 1u<<i;
+	return bits;
+#endif
+}
+static uint8_t CountBits(uint32_t w)
+{
+#if defined(_MSC_VER)
+	return (uint8_t)__popcnt(w);
+#else
+	return (uint8_t)__builtin_popcount(w);
+#endif
+}
+// mask of the clusters in the word starting at base that exist (2 to count_of_clusters+1)
+static uint32_t ValidBits(YY_DRIVE* drive, uint32_t base)
+{
+	uint32_t nClusters = drive->count_of_clusters + 2;
+	uint32_t bits = 0xffffffff;
+	if(base<2) bits &= ~3u;
+	if(base+32>nClusters) bits &= base>=nClusters ? 0 : (1u<<(nClusters-base))-1;
+	return bits;
+}
+// Read through the whole FAT once counting the free and bad clusters and, if bMap, setting the
+// bits in the free map as we go
+static void ScanFAT(YY_DRIVE* drive, bool bMap, uint32_t* nFree, uint32_t* nBad)
+{
+	uint32_t nClusters = drive->count_of_clusters + 2;		// includes the two reserved entries
+	*nFree = *nBad = 0;
+	if(drive->fat_type==FAT12){						// only a few sectors so do it the easy way
+		for(uint32_t c=2; c<nClusters; ++c){
+			uint32_t e = get12bitsFAT(drive, c);
+			if(e==0){
+				if(bMap) *FreeWord(drive, c/32) |= 1u<<(c%32);
+				++*nFree;
+			}
+			else if(e==drive->fatOps->bad)
+				++*nBad;
+		}
 		return;
 	}
+	// stream the sectors past rather than fill the caches with them
+	for(int i=0; i<N_FATBUFFERS; ++i)
+		FlushFatBuffer(drive, &drive->fatBuffers[i]);
+	// and read them in runs of FREEMAP_READ sectors
+	uint16_t perSector = drive->fat_type==FAT32 ? 128 : 256;
+	uint32_t buffer[128*FREEMAP_READ];
+	for(uint32_t sector=0; sector<drive->fat_size && sector*perSector<nClusters; sector+=FREEMAP_READ){
+		uint32_t n = drive->fat_size - sector;
+		if(n>FREEMAP_READ) n = FREEMAP_READ;
+		if(!YY_ReadSectors(drive->hDevice, drive->fat_begin_sector+sector, n, buffer)){
+			printf("Failed to read FAT sector %u scanning the FAT\n", sector);
+			break;
+		}
+		for(uint32_t t=0; t<n*perSector; t+=32){		// 32 entries at a time, a free map word
+			uint32_t base = sector*perSector + t;
+			if(base>=nClusters) break;
+			uint32_t valid = ValidBits(drive, base);
+			uint32_t free, bad;
+			if(perSector==128){
+				free = MatchBits32(buffer+t, 0);
+				bad	 = MatchBits32(buffer+t, drive->fatOps->bad);
+			}
+			else{
+				free = MatchBits16((uint16_t*)buffer+t, 0);
+				bad	 = MatchBits16((uint16_t*)buffer+t, (uint16_t)drive->fatOps->bad);
+			}
+			free &= valid;
+			if(bMap) *FreeWord(drive, base/32) = free;
+			*nFree += CountBits(free);
+			*nBad  += CountBits(bad & valid);
+		}
+	}
+}
+// build the bitmap by reading through the whole FAT once
+void YY_BuildFreeMap(YY_DRIVE* drive)
+{
+	uint32_t nClusters = drive->count_of_clusters + 2;		// includes the two reserved entries
+	uint32_t nWords	   = (nClusters+31)/32;
+	uint16_t nPages	   = (uint16_t)((nWords+FREEMAP_PAGE_WORDS-1)/FREEMAP_PAGE_WORDS);
+
+	drive->freeMap = (uint32_t**)XX_alloc(nPages*sizeof(uint32_t*));
+	if(drive->freeMap==nullptr) return;
+	for(uint16_t i=0; i<nPages; ++i){
+		drive->freeMap[i] = (uint32_t*)XX_alloc(FREEMAP_PAGE_WORDS*sizeof(uint32_t));
+		if(drive->freeMap[i]==nullptr){				// never mind, we can manage without
+			while(i) XX_free(drive->freeMap[--i]);
+			XX_free(drive->freeMap);
+			drive->freeMap = nullptr;
+			return;
+		}
+		memset(drive->freeMap[i], 0, FREEMAP_PAGE_WORDS*sizeof(uint32_t));
+	}
+	drive->freeMapPages = nPages;
+	ScanFAT(drive, true, &drive->free_clusters, &drive->bad_clusters);
+}
+// read the whole FAT12 into drive->fat12 one triad (three sectors, 1024 entries) at a time
+void YY_LoadFat12(YY_DRIVE* drive)
+{
+	uint32_t nEntries = drive->fat_size*1024/3;		// all of it, not just the ones in use
+	if(nEntries*2 > 0xffff) return;					// silly size so do it the old way
+	uint16_t* fat = (uint16_t*)XX_alloc((uint16_t)(nEntries*2));
+	if(fat==nullptr) return;
+	uint8_t triad[3*512];
+	for(uint32_t sector=0; sector<drive->fat_size; sector+=3){
+		uint32_t n = drive->fat_size - sector;
+		if(n>3) n = 3;
+		if(!YY_ReadSectors(drive->hDevice, drive->fat_begin_sector+sector, n, triad)){
+			printf("Failed to read FAT sector %u\n", sector);
+			XX_free(fat);
+			return;
+		}
+		for(uint16_t i=0; i<1024 && (sector/3)*1024+i<nEntries; ++i)
+			fat[(sector/3)*1024+i] = get12bitsA(triad, i);
+	}
+	drive->fat12		= fat;
+	drive->fat12Entries = (uint16_t)nEntries;
+}
+// find n contiguous free clusters starting the search at begin (or drive->next_free if that's 0)
+// and wrapping around, return the first or 0 if there isn't a run that long
+static uint32_t FindFreeRun(YY_DRIVE* drive, uint32_t n, uint32_t begin=0)
+{
+	uint32_t nClusters = drive->count_of_clusters + 2;
+	if(begin==0) begin = drive->next_free;
+	if(begin<2 || begin>=nClusters) begin = 2;
+
+	for(int pass=0; pass<2; ++pass){
+		uint32_t c	 = pass ? 2 : begin;
+		uint32_t end = pass ? begin+n-1 : nClusters;	// second time round just up to where we started
+		if(end>nClusters) end = nClusters;
+		uint32_t run = 0, first = 0;
+		while(c<end){
+			uint32_t w = *FreeWord(drive, c/32) >> (c%32);	// bits from c to the end of the word
+			if(w==0){								// nothing free in the rest of this word
+				run = 0;
+				c = (c|31)+1;
+				continue;
+			}
+			if(run==0){								// skip to the first free one
+				c += LowestBit(w);
+				if(c>=end) break;
+				first = c;
+				w = *FreeWord(drive, c/32) >> (c%32);
+			}
+			// count how far the run goes in this word
+			uint8_t avail = 32 - c%32;
+			uint8_t k = ~w ? LowestBit(~w) : 32;	// the zeros shifted in stop it at the word end
+			run += k;
+			c	+= k;
+			if(run>=n)
+				return first;
+			if(k<avail)								// stopped in the word so the run is broken
+				run = 0;
+		}
+	}
+	return 0;
 }
 // Find an unallocated fat cluster and mark it as 'end of chain' and return its cluster number
 // return 0 on disk full
@@ -251,116 +692,221 @@ void YY_SetClusterEntry(YY_DRIVE* drive, uint32_t cluster, uint32_t value)
 // release more clusters lower in the list.
 uint32_t YY_AllocateCluster(YY_DRIVE* drive)
 {
+	if(drive->freeMap){
+		uint32_t c = FindFreeRun(drive, 1);
+		if(c==0) return 0;								// disk full
+		YY_SetClusterEntry(drive, c, 0x0fffffff);		// mark as 'end of chain'
+		drive->next_free = c+1;
+		return c;
+	}
+	uint32_t found = 0;
+	uint32_t nClusters = drive->count_of_clusters + 2;	// valid entries are 2 to count_of_clusters+1
 again:
 	// Again I have three separate systems rather than try and put the switch in every loop
 	if(drive->fat_type==FAT32){
-		for(uint32_t sector=drive->fat_free_speedup; sector<drive->fat_size; ++sector){
+		for(uint32_t sector=drive->fat_free_speedup; !found && sector<drive->fat_size && sector*128<nClusters; ++sector){
 			uint32_t* array = (uint32_t*)GetFatSector(drive, sector);
-			uint32_t clusters_to_go = drive->count_of_clusters - sector*128;	// break out the limit for speed
-			for(uint16_t t=0; t<128 && t<clusters_to_go; ++t){
-				uint32_t v = array[t];
-				if((t & 0xfffffff)==0){		// unallocated
-					v |= 0x0fffffff;		// mark as 'end of chain' (preserve the top 4 bits)
-					array[t] = v;
-					drive->fat_dirty = true;
+			for(uint16_t t=0; t<128; t+=32){
+				uint32_t free = MatchBits32(array+t, 0) & ValidBits(drive, sector*128+t);	// unallocated
+				if(free){
 					drive->fat_free_speedup = sector;
-					return t + sector*128;
+					found = sector*128 + t + LowestBit(free);
+					break;
 				}
 			}
 		}
-end:	if(drive->fat_free_speedup){		// failed so dump the speed-up and try again
-			drive->fat_free_speedup = 0;
-			goto again;
-		}
-		return 0;			// really failed
 	}
-	if(drive->fat_type==FAT16){
-		for(uint32_t sector = drive->fat_free_speedup; sector<drive->fat_size; ++sector){
+	else if(drive->fat_type==FAT16){
+		for(uint32_t sector=drive->fat_free_speedup; !found && sector<drive->fat_size && sector*256<nClusters; ++sector){
 			uint16_t* array = (uint16_t*)GetFatSector(drive, sector);
-			uint32_t clusters_to_go = drive->count_of_clusters - sector*256;	// break out the limit for speed
-			for(uint16_t t=0; t<256 && t<clusters_to_go; ++t){
-				uint16_t v = array[t];
-				if(t==0){					// unallocated
-					array[t] = 0xffff;		// allocated as end of chain
-					drive->fat_dirty = true;
+			for(uint16_t t=0; t<256; t+=32){
+				uint32_t free = MatchBits16(array+t, 0) & ValidBits(drive, sector*256+t);	// unallocated
+				if(free){
 					drive->fat_free_speedup = sector;
-					return t + sector*256;
+					found = sector*256 + t + LowestBit(free);
+					break;
 				}
 			}
 		}
-		goto end;
-	}
-	// If we get here it's FAT12 time again
-	for(uint32_t sector=drive->fat_free_speedup; sector<drive->fat_size; sector+=3){	// do them 3 at a time as usual
-		uint32_t clusters_to_go = drive->count_of_clusters - (sector/3)*1023;			// break out the limit for speed
-		// sector 0
-		uint8_t* array = (uint8_t*)GetFatSector(drive, sector);
-		for(uint16_t index=0; index<341 && index<clusters_to_go; ++index){	// do 0-340 inclusive that's 170 pairs and one extra
-			uint16_t element = get12bitsA(array, index);				// which leaves us 4 bytes to overhang
-			if(element==0){
-				set12bitsA(array, index, 0xfff);						// mark End of Chain
-				drive->fat_dirty = true;
-				drive->fat_free_speedup = sector;
-				return (sector/3)*1024 + index;							// return index
+	}
+	else if(drive->fat12){
+		for(uint32_t c=drive->fat_free_speedup ? drive->next_free : 2; c<nClusters && c<drive->fat12Entries; ++c)
+			if(drive->fat12[c]==0 && c>=2){
+				drive->fat_free_speedup = 1;			// anything non zero will do
+				found = c;
+				break;
 			}
-		}
-		// do the overlap on 341
-		if(341<clusters_to_go){
-			drive->fatPrefix = array[511];						// copy the last byte, we want 4 bits as an 'odd' element
-			array = (uint8_t*)GetFatSector(drive, sector+1)-2;	// set the array start at -2 so the pair containing 341 is the first
-			uint16_t element = get12bitsA(array, 1);			// get element 1 (so I don't need array[0])
-			if(element==0){
-				set12bitsA(array, 1, 0xfff);					// mark End of Chain overwrites into fatPrefix
-				drive->fat_dirty = true;
-				array = (uint8_t*)GetFatSector(drive, sector);	// get sector 1 to do the bits in there
-				set12bitsA(array, 341, 0xfff);					// write the end of chain (overflows into fatSuffix)
-				drive->fat_dirty = true;
-				drive->fat_free_speedup = sector;
-				return (sector/3)*1024 + 341;					// return index
+	}
+	else{
+		// If we get here it's FAT12 time again
+		for(uint32_t sector=drive->fat_free_speedup; !found && sector<drive->fat_size && (sector/3)*1024<nClusters; sector+=3){	// do them 3 at a time as usual
+			uint32_t clusters_to_go = nClusters - (sector/3)*1024;			// break out the limit for speed
+			// sector 0
+			uint8_t* array = (uint8_t*)GetFatSector(drive, sector);
+			for(uint16_t index=0; index<341 && index<clusters_to_go; ++index)	// do 0-340 inclusive that's 170 pairs and one extra
+				if(get12bitsA(array, index)==0 && (sector/3)*1024+index>=2){	// which leaves us 4 bytes to overhang
+					found = (sector/3)*1024 + index;
+					break;
+				}
+			// do the overlap on 341
+			if(!found && 341<clusters_to_go){
+				uint8_t overlap = array[511];						// copy the last byte, we want 4 bits as an 'odd' element
+				array = (uint8_t*)GetFatSector(drive, sector+1)-2;	// set the array start at -2 so the pair containing 341 is the first
+				array[1] = overlap;									// into the buffer's fatPrefix
+				if(get12bitsA(array, 1)==0)							// get element 1 (so I don't need array[0])
+					found = (sector/3)*1024 + 341;
 			}
-		}
-		// do the sector+1 which we already have in buffer at -2 hence index 0 = 340 and index 2 is 342
-		for(uint16_t index=342; index<681 && index<clusters_to_go; ++index){		// do 342-681 inclusive
-			uint16_t element = get12bitsA(array, index-340);				// allow for array being '-2'
-			if(element==0){
-				set12bitsA(array, index-340, 0xfff);						// mark End of Chain
-				drive->fat_dirty = true;
-				drive->fat_free_speedup = sector;
-				return (sector/3)*1024 + index;								// return index
+			// do the sector+1 which we already have in buffer at -2 hence index 0 = 340 and index 2 is 342
+			for(uint16_t index=342; !found && index<682 && index<clusters_to_go; ++index)	// do 342-681 inclusive
+				if(get12bitsA(array, index-340)==0){							// allow for array being '-2'
+					found = (sector/3)*1024 + index;
+					break;
+				}
+			// do the overlap at 682
+			if(!found && 682<clusters_to_go){
+				uint8_t overlap = array[513];							// the last byte of sector+1 (remember the -2)
+				array = (uint8_t*)GetFatSector(drive, sector+2)-1;		// -1 so index0 is 682 (even)
+				array[0] = overlap;										// into the buffer's fatPrefix
+				if(get12bitsA(array, 0)==0)
+					found = (sector/3)*1024 + 682;
 			}
-		}
-		// do the overlap at 682
-		if(682<clusters_to_go){
-			drive->fatPrefix = array[511];							// copy the last byte
-			array = (uint8_t*)GetFatSector(drive, sector+2)-1;		// -1 so index0 is 682 (even)
-			uint16_t element = get12bitsA(array, 0);
-			if(element==0){
-				set12bitsA(array, 0, 0xfff);					// mark End of Chain
-				drive->fat_dirty = true;
-				array = (uint8_t*)GetFatSector(drive, sector+1);
-				array[511] = 0xff;								// simpler
-				drive->fat_dirty = true;
+			// do the sector+2 which we have in buffer at -1 hence index 0 = 682
+			for(uint16_t index=683; !found && index<1024 && index<clusters_to_go; ++index)	// do 683-1023 inclusive
+				if(get12bitsA(array, index-682)==0){							// allow for array being '-1'
+					found = (sector/3)*1024 + index;
+					break;
+				}
+			if(found)
 				drive->fat_free_speedup = sector;
-				return (sector/3)*1024 + 682;					// return index
-			}
 		}
-		// do the sector+1 which we already have in buffer at -2 hence index 0 = 340 and index 2 is 342
-		for(uint16_t index=683; index<1024 && index<clusters_to_go; ++index){	// do 342-681 inclusive
-			uint16_t element = get12bitsA(array, index-682);				// allow for array being '-2'
-			if(element==0){
-				set12bitsA(array, index-682, 0xfff);						// mark End of Chain
-				drive->fat_dirty = true;
-				drive->fat_free_speedup = sector;
-				return (sector/3)*1024 + index;								// return index
+	}
+	if(found){
+		YY_SetClusterEntry(drive, found, 0x0fffffff);		// mark as 'end of chain'
+		drive->next_free = found+1;
+		return found;
+	}
+	if(drive->fat_free_speedup){		// failed so dump the speed-up and try again
+		drive->fat_free_speedup = 0;
+		goto again;
+	}
+	return 0;			// really failed
+}
+// Allocate n contiguous clusters chained together, return the first or 0 if there isn't
+// a run that long. The search starts at hint if you give it (say just past the end of the file
+// you are growing) so things that belong together end up together. Without the free map this is
+// a slow walk of the FAT.
+uint32_t YY_AllocateClusters(YY_DRIVE* drive, uint32_t n, uint32_t hint)
+{
+	if(n==0) return 0;
+	uint32_t first = 0;
+	if(drive->freeMap)
+		first = FindFreeRun(drive, n, hint);
+	else{
+		uint32_t nClusters = drive->count_of_clusters + 2;
+		if(hint<2 || hint>=nClusters) hint = 2;
+		uint32_t run = 0;
+		for(uint32_t i=0; i<nClusters-2; ++i){
+			uint32_t c = hint+i < nClusters ? hint+i : hint+i-(nClusters-2);	// wrap round
+			if(c==2) run = 0;								// a run can't wrap with us
+			if(drive->fatOps->get(drive, c)!=0){
+				run = 0;
+				continue;
 			}
+			if(run++==0) first = c;
+			if(run==n) break;
 		}
+		if(run<n) first = 0;
 	}
-	goto end;	// we failed but try again without the speed-up just in case...
+	if(first==0) return 0;
+	for(uint32_t c=first; c<first+n-1; ++c)			// link them up
+		YY_SetClusterEntry(drive, c, c+1);
+	YY_SetClusterEntry(drive, first+n-1, 0x0fffffff);	// and end the chain
+	drive->next_free = first+n;
+	return first;
+}
+// Grow a chain in place: take up to n free clusters straight after last (which must be the end
+// of its chain) and link them on. Returns how many it got, possibly none.
+uint32_t YY_ExtendChain(YY_DRIVE* drive, uint32_t last, uint32_t n)
+{
+	uint32_t nClusters = drive->count_of_clusters + 2;
+	uint32_t got = 0;
+	while(got<n && last+got+1<nClusters){
+		uint32_t c = last+got+1;
+		bool bFree = drive->freeMap ? (*FreeWord(drive, c/32)>>(c%32)) & 1 : drive->fatOps->get(drive, c)==0;
+		if(!bFree) break;
+		++got;
+	}
+	for(uint32_t c=last; c<last+got; ++c)				// link them up
+		YY_SetClusterEntry(drive, c, c+1);
+	if(got){
+		YY_SetClusterEntry(drive, last+got, 0x0fffffff);
+		if(drive->next_free<=last+got) drive->next_free = last+got+1;
+	}
+	return got;
+}
+// Free a chain from cluster on, a run of clusters at a time. What we free below next_free moves it
+// back (and the FAT scan starts again from the bottom) so the space gets used again first rather
+// than every file leaving the clusters it reserved and didn't use behind it as a hole.
+void YY_FreeChain(YY_DRIVE* drive, uint32_t cluster)
+{
+	uint32_t lowest = 0xffffffff;
+	for(uint32_t n=drive->count_of_clusters; n && !YY_EndOfChain(drive, cluster); ){	// n stops a loop
+		uint32_t run = YY_ChainRun(drive, cluster, n-1, true);	// links straight on so no need to read them
+		uint32_t next = drive->fatOps->get(drive, cluster+run);
+		for(uint32_t c=0; c<=run; ++c)
+			YY_SetClusterEntry(drive, cluster+c, 0);
+		if(cluster<lowest) lowest = cluster;
+		n -= run+1;
+		cluster = next;
+	}
+	if(lowest<drive->next_free){
+		drive->next_free		= lowest;
+		drive->fat_free_speedup	= 0;
+	}
+}
+// How much space is there? (in clusters)
+uint32_t YY_FreeClusters(YY_DRIVE* drive)
+{
+	YY_LockFat(drive);
+	if(drive->free_clusters==0xffffffff)			// not known yet so count them
+		ScanFAT(drive, false, &drive->free_clusters, &drive->bad_clusters);
+	uint32_t n = drive->free_clusters;
+	YY_UnlockFat(drive);
+	return n;
+}
+// and how many are marked bad (0xffffffff if we haven't looked)
+uint32_t YY_BadClusters(YY_DRIVE* drive)
+{
+	YY_LockFat(drive);
+	if(drive->bad_clusters==0xffffffff)
+		ScanFAT(drive, false, &drive->free_clusters, &drive->bad_clusters);
+	uint32_t n = drive->bad_clusters;
+	YY_UnlockFat(drive);
+	return n;
+}
+//-------------------------------------------------------------------------------------------------
+// Is this FAT entry the end of a chain? (or something else that isn't a link to follow)
+//-------------------------------------------------------------------------------------------------
+bool YY_EndOfChain(YY_DRIVE* drive, uint32_t entry)
+{
+	return entry<2 || entry>=drive->fatOps->bad;		// free or reserved is not a link, nor is bad or end of chain
+}
+// How many times does the chain from cluster go straight on to the next cluster? (up to max)
+uint32_t YY_ChainRun(YY_DRIVE* drive, uint32_t cluster, uint32_t max, bool bHeld)
+{
+	uint32_t last = drive->count_of_clusters + 1;		// highest valid cluster
+	if(cluster>=last) return 0;
+	if(max > last-cluster) max = last-cluster;
+	if(bHeld) return drive->fatOps->run(drive, cluster, max);
+	YY_LockFat(drive);
+	uint32_t n = drive->fatOps->run(drive, cluster, max);
+	YY_UnlockFat(drive);
+	return n;
 }
 //-------------------------------------------------------------------------------------------------
 // get the next sector in a file
 //-------------------------------------------------------------------------------------------------
-uint32_t YY_GetNextSector(YY_DRIVE* drive, uint32_t current_sector)
+uint32_t YY_GetNextSector(YY_DRIVE* drive, uint32_t current_sector, bool bHeld)
 {
 	if(current_sector < drive->cluster_begin_sector)	// beware the FAT12/FAT16 root directory
 		return ++current_sector >= drive->cluster_begin_sector ? 0 : current_sector;
@@ -368,7 +914,7 @@ uint32_t YY_GetNextSector(YY_DRIVE* drive, uint32_t current_sector)
 	uint32_t x = (current_sector+1) & drive->sectors_in_cluster_mask;
 	if(x) return current_sector+1;
 	// if x==0 we have reached the end of the cluster
-	uint32_t n = YY_GetClusterEntry(drive, YY_SectorToCluster(drive, current_sector));
-	if(n==0xfffffff) return 0;										// EOF
+	uint32_t n = YY_GetClusterEntry(drive, YY_SectorToCluster(drive, current_sector), bHeld);
+	if(YY_EndOfChain(drive, n)) return 0;							// EOF
 	return YY_ClusterToSector(drive, n);								// first sector in cluster
 }
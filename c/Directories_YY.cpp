@@ -4,14 +4,15 @@
 
 #include <cstdio>
 #include <cstdint>
+#include <cstring>
 #include <cassert>
 #include <inttypes.h>		// see: https://en.cppreference.com/w/cpp/types/integer for printf'ing silly things
-#include <windows.h>
+#include "FAT_OS.h"		// <windows.h> or the bits of it we need
 
 #include "FAT_XX.h"
 #include "FAT_YY.h"
 
-uint16_t temp1[MAX_PATH], temp2[MAX_PATH];	// community text buffers
+static uint8_t shortChecksum(uint8_t* shortName);
 
 // the default device tells us which devices cwd to use
 uint8_t	YY_defaultDevice = 'C';
@@ -19,35 +20,37 @@ uint8_t	YY_defaultDevice = 'C';
 //=================================================================================================
 // Directory slots
 //=================================================================================================
-#define MAX_DIRECTORY	20
-YY_DIRECTORY	directories[MAX_DIRECTORY]{};
+static YY_POOL dirPool{ sizeof(YY_DIRECTORY), YY_DIRS_PER_ARENA };
 
 static YY_DIRECTORY* GetDirectorySlot()
 {
-	for(int i=0; i<MAX_DIRECTORY; ++i)
-		if(directories[i].drive == 0)
-			return &directories[i];
-	return nullptr;
+	YY_DIRECTORY* dir = (YY_DIRECTORY*)YY_PoolGet(&dirPool);
+	if(dir==nullptr){
+		printf("Out of directory slots (%d in use)\n", dirPool.used);
+		return nullptr;
+	}
+	*dir = YY_DIRECTORY{};
+	return dir;
 }
 static void FreeDirectorySlot(YY_DIRECTORY* dir)
 {
-	dir->drive = 0;		// keep this as a routine as we might allocate stuff later
+	YY_ReleaseSector(dir->buffer);		// unpin our sector
+	dir->buffer = nullptr;
+	YY_ReleasePath(dir->path);
+	dir->path = nullptr;
+	if(dir->window) XX_free(dir->window);
+	dir->window = nullptr;
+	dir->sectorinbuffer = 0xffffffff;
+	dir->drive = 0;
+	YY_PoolPut(&dirPool, dir);
 }
 int YY_Dused(){			// debug only
-	int n=0;
-	for(int i=0; i<MAX_DIRECTORY; ++i)
-		if(directories[i].drive!=0)
-			++n;
-	return n;
+	return dirPool.used;
 }
 #if _DEBUG
 int UsedDirectorySlots()
 {
-	int n=0;
-	for(int i=0; i<MAX_DIRECTORY; ++i)
-		if(directories[i].drive!=0)
-			++n;
-	return n;
+	return dirPool.used;
 }
 #endif
 //-------------------------------------------------------------------------------------------------
@@ -64,44 +67,47 @@ struct DIRL {
 	uint16_t	LDIR_FstClusLO;	// 26 0
 	uint16_t	LDIR_Name3[2];	// 28 characters 12-13
 };
-static void UnpackLong(YY_FILE* file, YY_DIRN* dirn)
+static void UnpackLong(YY_DIRECTORY* dir, YY_DIRN* dirn)
 {
-	assert(sizeof DIRL==32);
+	assert(sizeof(DIRL)==32);
 
 	DIRL *d = (DIRL*)dirn;
 	if(d->LDIR_Ord & 0x40){		// if first
-		for(int i=0; i<MAX_PATH; file->longName[i++]=0);
-		file->shortnamechecksum = d->LDIR_ChkSum;
+		for(int i=0; i<MAX_PATH; dir->itemName[i++]=0);
+		dir->checksum = d->LDIR_ChkSum;
 	}
 	else{
-		if(file->shortnamechecksum!=d->LDIR_ChkSum)
+		if(dir->checksum!=d->LDIR_ChkSum)
 			printf("LongName checksum error type 1\n");
 	}
 	uint16_t index = ((d->LDIR_Ord & 0x3f)-1)*13;	// where we put these character in long name
 	bool run=true;
 	for(int j=0; run && j<5; ++j){
 		if(d->LDIR_Name1[j]==0){ run=false; break; }
+#if defined(_MSC_VER)
 #pragma warning( push )
 #pragma warning( disable: 6386 )
-		file->longName[index++] = d->LDIR_Name1[j];
+#endif
+		dir->itemName[index++] = d->LDIR_Name1[j];
+#if defined(_MSC_VER)
 #pragma warning( pop)
+#endif
 	}
 	for(int j=0; run && j<6; ++j){
 		if(d->LDIR_Name2[j]==0){ run=false; break; }
-		file->longName[index++] = d->LDIR_Name2[j];
+		dir->itemName[index++] = d->LDIR_Name2[j];
 	}
 	for(int j=0; run && j<2; ++j){
 		if(d->LDIR_Name3[j]==0){ run=false; break; }
-		file->longName[index++] = d->LDIR_Name3[j];
+		dir->itemName[index++] = d->LDIR_Name3[j];
 	}
 }
 //--------------------------------------------------------------------------------------------------
 // Make the flag letters for the folder display
 //--------------------------------------------------------------------------------------------------
 
-static const char* MakeFlags(uint8_t att)
+static const char* MakeFlags(uint8_t att, char* flags)	// flags[7]
 {
-	static char flags[7];
 	flags[0] = (att & ATTR_RO)		? 'R': '.';		// read only
 	flags[1] = (att & ATTR_HIDE)	? 'H': '.';		// hidden
 	flags[2] = (att & ATTR_SYS)		? 'S': '.';		// system
@@ -130,7 +136,7 @@ static void MakeLongFromShort(uint8_t *shortName, uint16_t *longName, uint8_t fl
 		for(int i=8; i<11; longName[j++] = tolower(shortName[i++]));
 	else
 		for(int i=8; i<11; longName[j++] = shortName[i++]);
-	while(j && (longName[j-1]==' ' || (longName[j-1]=='.') && j>k)) --j;	// remove trailing spaces and if there is no extension the , too
+	while(j && (longName[j-1]==' ' || (longName[j-1]=='.' && j>k))) --j;	// remove trailing spaces and if there is no extension the , too
 	longName[j] = 0;
 }
 //-------------------------------------------------------------------------------------------------
@@ -138,17 +144,18 @@ static void MakeLongFromShort(uint8_t *shortName, uint16_t *longName, uint8_t fl
 //-------------------------------------------------------------------------------------------------
 void YY_AddPath(uint16_t* dest, uint16_t* src)			// both buffers are MAX_PATH
 {
-	if(wcscmp((wchar_t*)src, L".")==0)
+	if(src[0]=='.' && src[1]==0)
 		return;
-	if(wcscmp((wchar_t*)src, L"..")==0){
-		for(int i=(int)wcslen((wchar_t*)dest)-1; i>0; --i){
+	if(src[0]=='.' && src[1]=='.' && src[2]==0){
+		for(int i=YY_WideLen(dest)-1; i>0; --i){
 			dest[i] = 0;
 			if(dest[i-1]=='/') return;
 		}
 	}
 	else{
-		wcscat_s((wchar_t*)dest, MAX_PATH, (wchar_t*)src);
-		wcscat_s((wchar_t*)dest, MAX_PATH, L"/");
+		const uint16_t slash[] = { '/', 0 };
+		YY_WideCat(dest, MAX_PATH, src);
+		YY_WideCat(dest, MAX_PATH, slash);
 	}
 }
 //-------------------------------------------------------------------------------------------------
@@ -181,26 +188,305 @@ static bool getToken(uint16_t* text, uint16_t &index, uint16_t* buffer)
 	buffer[outIndex] = 0;
 	return outIndex!=0;
 }
+//-------------------------------------------------------------------------------------------------
+// Name cache
+// Opening a path means finding each folder in its parent and then the file in the last one and
+// a relative path replays the CWD from the root first. Rather than scan every directory every time
+// we remember where in its directory each name we have looked up lives. A hit just reads that
+// entry again and checks it is still the right name so a stale one costs a scan and no more.
+// Anything that changes a directory should still call YY_ForgetNames() for it.
+//-------------------------------------------------------------------------------------------------
+#ifndef N_NAMECACHE
+#define N_NAMECACHE		32				// names remembered over all the drives
+#endif
+
+struct YY_NAME {
+	YY_DRIVE*	drive{};				// nullptr if free
+	uint32_t	dirCluster{};			// directory the name is in, 0 for the FAT12/16 root
+	uint16_t	hash{};					// of the case folded name
+	uint32_t	sector{};				// where its first directory entry is
+	uint8_t		slot{};
+	uint32_t	last_used{};			// LRU stamp
+};
+static YY_NAME	names[N_NAMECACHE]{};
+static uint32_t	name_clock{};
+static uint32_t	name_hits{}, name_misses{};
+static XX_LOCK	nameLock = XX_LOCK_INIT;		// names[] and indexes[] (below), held for a whole lookup
+
+static uint16_t hashName(uint16_t* name)
+{
+	uint16_t h = 0;
+	while(*name)
+		h = (uint16_t)((h<<5) + (h>>11) + YY_Fold(*name++));	// rotate and add
+	return h;
+}
+static YY_NAME* findName(YY_DRIVE* drive, uint32_t dirCluster, uint16_t hash)
+{
+	for(int i=0; i<N_NAMECACHE; ++i)
+		if(names[i].drive==drive && names[i].dirCluster==dirCluster && names[i].hash==hash)
+			return &names[i];
+	return nullptr;
+}
+static void rememberName(YY_DIRECTORY* dir, uint16_t hash, YY_FILE* file)
+{
+	YY_NAME* n = findName(dir->drive, dir->startCluster, hash);
+	if(n==nullptr){
+		n = &names[0];									// the free or least recently used one
+		for(int i=0; i<N_NAMECACHE && n->drive; ++i)
+			if(names[i].drive==nullptr || names[i].last_used < n->last_used)
+				n = &names[i];
+	}
+	n->drive	  = dir->drive;
+	n->dirCluster = dir->startCluster;
+	n->hash		  = hash;
+	n->sector	  = file->dirSector;
+	n->slot		  = file->dirSlot;
+	n->last_used  = ++name_clock;
+}
+//-------------------------------------------------------------------------------------------------
+// Name index
+// A big folder is still a long scan for a name we haven't seen before (or one that isn't there)
+// so the first time we scan a directory we note every item's long and short names by hash into a
+// table and after that a lookup is a probe and a check of the entries with the same hash. Small
+// directories aren't worth it and are just scanned. YY_NameAdded() keeps a table in step with the
+// items we make and YY_ForgetNames() drops it for anything else.
+//-------------------------------------------------------------------------------------------------
+#ifndef N_NAMEINDEX
+#define N_NAMEINDEX		4				// directories indexed at once
+#endif
+#define NAMEINDEX_MIN	64				// items in a directory before it gets an index
+#define NAMEINDEX_PAGE	2048			// table entries per XX_alloc() (16K)
+#define NAMEINDEX_PAGES	32				// 64K entries, as many as a directory can have
+
+struct YY_INDEXENTRY {
+	uint32_t	sector;					// where the item's first directory entry is
+	uint16_t	hash;
+	uint8_t		slot;
+	uint8_t		used;					// 0 free, 1 in use
+};
+struct YY_NAMEINDEX {
+	YY_DRIVE*		drive{};			// nullptr if free
+	uint32_t		dirCluster{};
+	YY_INDEXENTRY*	pages[NAMEINDEX_PAGES]{};
+	uint16_t		nPages{};			// table size is a power of two pages
+	uint32_t		nUsed{};			// entries in use
+	uint32_t		last_used{};
+};
+static YY_NAMEINDEX	indexes[N_NAMEINDEX]{};
+
+static YY_INDEXENTRY* indexEntry(YY_NAMEINDEX* x, uint32_t i)
+{
+	return &x->pages[i/NAMEINDEX_PAGE][i%NAMEINDEX_PAGE];
+}
+static void freeIndex(YY_NAMEINDEX* x)
+{
+	while(x->nPages) XX_free(x->pages[--x->nPages]);
+	x->drive = nullptr;
+	x->nUsed = 0;
+}
+static YY_NAMEINDEX* findIndex(YY_DRIVE* drive, uint32_t dirCluster)
+{
+	for(int i=0; i<N_NAMEINDEX; ++i)
+		if(indexes[i].drive==drive && indexes[i].dirCluster==dirCluster)
+			return &indexes[i];
+	return nullptr;
+}
+static bool sizeIndex(YY_NAMEINDEX* x, uint16_t nPages)
+{
+	for(uint16_t i=x->nPages; i<nPages; ++i){
+		x->pages[i] = (YY_INDEXENTRY*)XX_alloc(NAMEINDEX_PAGE*sizeof(YY_INDEXENTRY));
+		if(x->pages[i]==nullptr) return false;
+		memset(x->pages[i], 0, NAMEINDEX_PAGE*sizeof(YY_INDEXENTRY));
+		x->nPages = i+1;
+	}
+	return true;
+}
+static bool indexAdd(YY_NAMEINDEX* x, uint16_t hash, uint32_t sector, uint8_t slot)
+{
+	uint32_t size = (uint32_t)x->nPages*NAMEINDEX_PAGE;
+	if((x->nUsed+1)*4 > size*3){						// keep it under 3/4 full so probes stay short
+		if(x->nPages*2 > NAMEINDEX_PAGES) return false;
+		YY_INDEXENTRY* old[NAMEINDEX_PAGES];
+		uint16_t nOld = x->nPages;
+		memcpy(old, x->pages, nOld*sizeof(YY_INDEXENTRY*));
+		x->nPages = 0;
+		x->nUsed  = 0;
+		bool ok = sizeIndex(x, nOld*2);
+		for(uint32_t i=0; ok && i<size; ++i){			// put everything back in the bigger table
+			YY_INDEXENTRY* e = &old[i/NAMEINDEX_PAGE][i%NAMEINDEX_PAGE];
+			if(e->used) ok = indexAdd(x, e->hash, e->sector, e->slot);
+		}
+		for(uint16_t i=0; i<nOld; ++i) XX_free(old[i]);
+		if(!ok) return false;
+		size *= 2;
+	}
+	uint32_t i = hash & (size-1);
+	YY_INDEXENTRY* e;
+	while((e=indexEntry(x, i))->used)					// linear probe
+		i = (i+1) & (size-1);
+	++x->nUsed;
+	e->sector = sector;
+	e->hash	  = hash;
+	e->slot	  = slot;
+	e->used	  = 1;
+	return true;
+}
+// the 8.3 name as we would display it, but only if it isn't what the long name is anyway
+static bool shortName(YY_FILE* file, uint16_t* name)
+{
+	MakeLongFromShort(file->dirn.DIR_Name, name, 0);
+	for(int i=0; ; ++i){
+		if(YY_Fold(name[i])!=YY_Fold(file->longName[i])) return true;
+		if(name[i]==0) return false;
+	}
+}
+#define SHORTNAME	13						// "FILENAME.EXT" and a zero
+static bool matchShort(YY_FILE* file, uint16_t* name)
+{
+	uint16_t text[SHORTNAME];
+	if(!shortName(file, text)) return false;
+	for(int i=0; ; ++i){
+		if(YY_Fold(text[i])!=YY_Fold(name[i])) return false;
+		if(name[i]==0) return true;
+	}
+}
+static bool indexItem(YY_NAMEINDEX* x, YY_FILE* file)
+{
+	uint16_t text[SHORTNAME];
+	if(!indexAdd(x, hashName(file->longName), file->dirSector, file->dirSlot)) return false;
+	if(shortName(file, text) && !indexAdd(x, hashName(text), file->dirSector, file->dirSlot)) return false;
+	return true;
+}
+// keep an index (and the name cache) in step with an item we have just made in a directory
+void YY_NameAdded(YY_DIRECTORY* dir, YY_FILE* file)
+{
+	YY_Lock(&nameLock);
+	YY_NAMEINDEX* x = findIndex(dir->drive, dir->startCluster);
+	if(x && !indexItem(x, file)) freeIndex(x);
+	YY_Unlock(&nameLock);
+}
+// drop the names in a directory we have changed (or all of a drive's names)
+void YY_ForgetNames(YY_DRIVE* drive, uint32_t dirCluster)
+{
+	YY_Lock(&nameLock);
+	for(int i=0; i<N_NAMECACHE; ++i)
+		if(names[i].drive==drive && (dirCluster==0xffffffff || names[i].dirCluster==dirCluster))
+			names[i].drive = nullptr;
+	for(int i=0; i<N_NAMEINDEX; ++i)
+		if(indexes[i].drive==drive && (dirCluster==0xffffffff || indexes[i].dirCluster==dirCluster))
+			freeIndex(&indexes[i]);
+	YY_Unlock(&nameLock);
+}
+#if _DEBUG
+void NameCacheStats(uint32_t* hits, uint32_t* misses)
+{
+	*hits	= name_hits;
+	*misses	= name_misses;
+}
+#endif
+// read the item whose entries start at sector/slot and check it has the name we want
+static YY_FILE* readItem(YY_DIRECTORY* dir, uint32_t sector, uint8_t slot, uint16_t* name)
+{
+	dir->sector	   = sector;
+	dir->slot	   = slot;
+	dir->readAhead = 0;
+	YY_FILE* file = YY_NextDirectoryItem(dir);
+	if(file && file->dirSector==sector && file->dirSlot==slot && (YY_matchName(file, name) || matchShort(file, name)))
+		return file;
+	if(file) YY_FreeFileSlot(file);
+	return nullptr;
+}
+//-------------------------------------------------------------------------------------------------
+// Find an item by name in a directory, you own the YY_FILE you get back.
+// This leaves the directory part way through so reset it before you walk it.
+//-------------------------------------------------------------------------------------------------
+static YY_FILE* findItem(YY_DIRECTORY* dir, uint16_t* name)
+{
+	uint16_t hash = hashName(name);
+	YY_FILE* file;
+	YY_NAME* n = findName(dir->drive, dir->startCluster, hash);
+	if(n){
+		file = readItem(dir, n->sector, n->slot, name);
+		if(file){
+			++name_hits;
+			n->last_used = ++name_clock;
+			return file;
+		}
+		n->drive = nullptr;							// stale or a different name with the same hash
+	}
+	++name_misses;
+
+	// if we have an index all the places the name could be are in it
+	YY_NAMEINDEX* x = findIndex(dir->drive, dir->startCluster);
+	if(x){
+		x->last_used = ++name_clock;
+		uint32_t size = (uint32_t)x->nPages*NAMEINDEX_PAGE;
+		for(uint32_t i = hash & (size-1); ; i = (i+1) & (size-1)){
+			YY_INDEXENTRY* e = indexEntry(x, i);
+			if(e->used==0) return nullptr;			// not here
+			if(e->hash==hash && (file = readItem(dir, e->sector, e->slot, name))!=nullptr){
+				rememberName(dir, hash, file);
+				return file;
+			}
+		}
+	}
+
+	// no so scan the lot building an index as we go
+	x = &indexes[0];								// the free or least recently used one
+	for(int i=0; i<N_NAMEINDEX && x->drive; ++i)
+		if(indexes[i].drive==nullptr || indexes[i].last_used < x->last_used)
+			x = &indexes[i];
+	freeIndex(x);
+	x->drive	  = dir->drive;
+	x->dirCluster = dir->startCluster;
+	x->last_used  = ++name_clock;
+	bool bIndex = sizeIndex(x, 1);
+	uint32_t nItems = 0;
+
+	YY_FILE* found = nullptr;
+	YY_ResetDirectory(dir);
+	while((file=YY_NextDirectoryItem(dir))!=nullptr){
+		++nItems;
+		if(bIndex && !indexItem(x, file)) bIndex = false;
+		if(found==nullptr && (YY_matchName(file, name) || matchShort(file, name))){
+			rememberName(dir, hash, file);
+			found = file;
+			if(!bIndex) break;
+		}
+		else
+			YY_FreeFileSlot(file);
+	}
+	if(!bIndex || !dir->bEnd || nItems<NAMEINDEX_MIN)	// didn't work, didn't see it all or wasn't worth it
+		freeIndex(x);
+	return found;
+}
+// readers share a drive but not the name cache, so one lookup at a time (they are quick once cached)
+YY_FILE* YY_FindDirectoryItem(YY_DIRECTORY* dir, uint16_t* name)
+{
+	YY_Lock(&nameLock);
+	YY_FILE* file = findItem(dir, name);
+	YY_Unlock(&nameLock);
+	return file;
+}
 // find the entry for path in dir and assume its start_sector and add it to the longPath
 bool YY_ChangeDirectory(YY_DIRECTORY* dir, uint16_t* path)
 {
 	if(path[0]==L'.' && path[1]==0)		// do the easy one first with a shortcut
 		return dir;
 	// notice that both "." and ".." are valid directory items
-	YY_FILE* file;
-	YY_ResetDirectory(dir);
-	while((file=YY_NextDirectoryItem(dir))!=nullptr){
-		if(YY_isDIR(file) && YY_matchName(file, path)){
-			YY_AddPath(dir->longPath, path);
-			dir->startCluster = file->startCluster;
-			dir->sector = 0;
-			dir->slot = 0;
-			YY_FreeFileSlot(file);
-			return true;
-		}
-		YY_FreeFileSlot(file);
+	YY_FILE* file = YY_FindDirectoryItem(dir, path);
+	if(file==nullptr) return false;
+	bool ret = YY_isDIR(file);
+	if(ret){
+		YY_AddPath(dir->longPath, path);
+		YY_ReleasePath(dir->path);		// items already out keep the old one
+		dir->path = nullptr;
+		dir->startCluster = file->startCluster;
+		dir->sector = 0;
+		dir->slot = 0;
 	}
-	return false;
+	YY_FreeFileSlot(file);
+	return ret;
 }
 // open with a path:
 // if it starts with "A:" you have selected a drive, if not you get the default
@@ -209,14 +495,10 @@ bool YY_ChangeDirectory(YY_DIRECTORY* dir, uint16_t* path)
 
 YY_DIRECTORY* YY_OpenDirectory(uint16_t* path)
 {
-	uint8_t driveLetter = YY_defaultDrive;
-	uint16_t index = 0;
-	if(path[1]==L':'){
-		driveLetter = (uint8_t)path[0];
-		index = 2;
-	}
-	YY_DRIVE* drive = YY_MountDrive(driveLetter);	// mount or hook into an already mounted drive
+	uint16_t index = path[0] && path[1]==L':' ? 2 : 0;
+	YY_DRIVE* drive = YY_PathDrive(path);			// mount or hook into an already mounted drive
 	if(drive==nullptr)	return nullptr;
+	uint16_t token[MAX_PATH];
 
 	YY_DIRECTORY* dir = GetDirectorySlot();	// get a slot to put our new YY_DIRECTORY in
 	if(dir==nullptr) return nullptr;
@@ -234,8 +516,8 @@ YY_DIRECTORY* YY_OpenDirectory(uint16_t* path)
 
 	if(path[index]!=L'\\' && path[index]!=L'/'){		// if no / use CWD for that drive
 		uint16_t cwdIndex=3;							// the CWD is at least "A:\"
-		while(getToken(drive->cwd, cwdIndex, temp1))	// read path element into temp and increment index
-			if(!YY_ChangeDirectory(dir, temp1)){		// move up one level
+		while(getToken(drive->cwd, cwdIndex, token))	// read path element into token and increment index
+			if(!YY_ChangeDirectory(dir, token)){		// move up one level
 				FreeDirectorySlot(dir);
 				return nullptr;
 			}
@@ -243,14 +525,38 @@ YY_DIRECTORY* YY_OpenDirectory(uint16_t* path)
 	else
 		++index;								// step over / to start of first folder
 
-	while(getToken(path, index, temp1))
-		if(!YY_ChangeDirectory(dir, temp1)){
+	while(getToken(path, index, token))
+		if(!YY_ChangeDirectory(dir, token)){
 			FreeDirectorySlot(dir);
 			return nullptr;
 		}
 	YY_ResetDirectory(dir);
 	return dir;
 }
+// open a folder we found in parent without looking it up by name again
+YY_DIRECTORY* YY_OpenDirectoryAt(YY_DIRECTORY* parent, YY_DIRENTRY* entry)
+{
+	if((entry->dirn.DIR_Attr & (ATTR_DIR | ATTR_VOL))!=ATTR_DIR) return nullptr;
+	YY_DIRECTORY* dir = GetDirectorySlot();
+	if(dir==nullptr) return nullptr;
+	dir->drive			= parent->drive;
+	dir->startCluster	= ((uint32_t)entry->dirn.DIR_FstClusHI<<16) | entry->dirn.DIR_FstClusLO;
+	memcpy(dir->longPath, parent->longPath, sizeof dir->longPath);
+	YY_AddPath(dir->longPath, entry->name);
+	YY_ResetDirectory(dir);
+	return dir;
+}
+// open a folder from its first cluster and its path as YY_Walk() queues them
+YY_DIRECTORY* YY_OpenDirectoryCluster(YY_DRIVE* drive, uint32_t startCluster, const uint16_t* longPath)
+{
+	YY_DIRECTORY* dir = GetDirectorySlot();
+	if(dir==nullptr) return nullptr;
+	dir->drive			= drive;
+	dir->startCluster	= startCluster;
+	memcpy(dir->longPath, longPath, (YY_WideLen(longPath)+1)*sizeof(uint16_t));
+	YY_ResetDirectory(dir);
+	return dir;
+}
 void YY_ResetDirectory(YY_DIRECTORY* dir)
 {
 	if(dir->startCluster==0)
@@ -258,107 +564,510 @@ void YY_ResetDirectory(YY_DIRECTORY* dir)
 	else
 		dir->sector = YY_ClusterToSector(dir->drive, dir->startCluster);
 	dir->slot = 0;
+	dir->readAhead = 0;
 }
-YY_FILE* YY_NextDirectoryItem(YY_DIRECTORY* dir)
+// get what we are about to read into the cache
+static void prefetch(YY_DIRECTORY* dir)
 {
-	YY_FILE* file = YY_GetFileSlot();
-	if(file==nullptr) return nullptr;
+	YY_DRIVE* drive = dir->drive;
+	if(dir->sector < drive->cluster_begin_sector){			// FAT12/16 root directory
+		if(dir->sector==drive->root_dir_first_sector)		// get a run of it in one go
+			YY_PrefetchSectors(drive->hDevice, dir->sector, (uint16_t)(drive->cluster_begin_sector - dir->sector));
+	}
+	else if((dir->sector & drive->sectors_in_cluster_mask)==0){	// first sector of a cluster so get the whole cluster
+		// and if we got here by reading the last one through and the next clusters follow on
+		// on the disk get those too, a bit more each time
+		uint16_t n = drive->sectors_in_cluster_mask+1;
+		if(dir->sectorinbuffer+1==dir->sector || dir->readAhead){
+			dir->readAhead = dir->readAhead ? dir->readAhead*2 : 2;
+			if(dir->readAhead > YY_READAHEAD_MAX) dir->readAhead = YY_READAHEAD_MAX;
+			uint32_t cluster = YY_SectorToCluster(drive, dir->sector);
+			YY_LockFat(drive);
+			while(n < dir->readAhead && YY_GetClusterEntry(drive, cluster, true)==cluster+1){
+				++cluster;
+				n += drive->sectors_in_cluster_mask+1;
+			}
+			YY_UnlockFat(drive);
+		}
+		YY_PrefetchSectors(drive->hDevice, dir->sector, n);
+	}
+}
+// pin the sector we are working through in the cache
+// it's only pinned for the length of a call (see unloadSector()) so open directories can't fill it
+static bool loadSector(YY_DIRECTORY* dir)
+{
+	if(dir->buffer && dir->sectorinbuffer == dir->sector)
+		return true;
+	if(dir->sectorinbuffer != dir->sector)				// not just pinning it again
+		prefetch(dir);
+	YY_ReleaseSector(dir->buffer);
+	dir->buffer = (YY_DIRSECT*)YY_GetSector(dir->drive->hDevice, dir->sector);
+	dir->sectorinbuffer = dir->buffer ? dir->sector : 0xffffffff;
+	return dir->buffer!=nullptr;
+}
+static void unloadSector(YY_DIRECTORY* dir)
+{
+	YY_ReleaseSector(dir->buffer);
+	dir->buffer = nullptr;
+}
+// give the item its own copy of the name we put together and a share of the directory's path
+static bool keepNames(YY_DIRECTORY* dir, YY_FILE* file)
+{
+	uint16_t n = YY_WideLen(dir->itemName)+1;
+	file->longName = (uint16_t*)XX_alloc(n*sizeof(uint16_t));
+	if(file->longName==nullptr) return false;
+	memcpy(file->longName, dir->itemName, n*sizeof(uint16_t));
 
-	for(int j=0; j<MAX_PATH; file->longName[j++]=0);
+	if(dir->path==nullptr){
+		n = YY_WideLen(dir->longPath)+1;
+		dir->path = (YY_PATH*)XX_alloc(sizeof(YY_PATH) + n*sizeof(uint16_t));
+		if(dir->path==nullptr) return false;
+		dir->path->refs = 1;						// the directory's own
+		memcpy(dir->path->text, dir->longPath, n*sizeof(uint16_t));
+	}
+	file->path = YY_SharePath(dir->path);
+	return true;
+}
+// fill in the slot with the next item, nullptr at the end
+static YY_FILE* nextItem(YY_DIRECTORY* dir, YY_FILE* file)
+{
+	memset(dir->itemName, 0, sizeof dir->itemName);
 
 	// load the buffer for YY_NextDirectoryItem
-	if(dir->sectorinbuffer != dir->sector)
-		if(!XX_ReadSector(dir->drive->hDevice, dir->sector, &dir->buffer))
-			return nullptr;
-	dir->sectorinbuffer = dir->sector;
+	if(!loadSector(dir))
+		return nullptr;
 
+	file->dirSector = 0;						// not started an item yet
 	while(true){
 		// is it time for a new sector?
 		if(dir->slot>=16){
 //			YY_DirFlush(dir);					// <<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<
 			dir->sector = YY_GetNextSector(dir->drive, dir->sector);
-			if(dir->sector==0) return nullptr;
-			if(!XX_ReadSector(dir->drive->hDevice, dir->sector, &dir->buffer)) return nullptr;
-//			dump(&dir->buffer, 512);
+			if(dir->sector==0){
+				dir->bEnd = true;				// end of the chain
+				return nullptr;
+			}
+			if(!loadSector(dir)) return nullptr;
+//			dump(dir->buffer, 512);
 			dir->slot = 0;
 		}
 		// next entry
 		while(dir->slot<16){
-			YY_DIRN* d = &dir->buffer.entry[dir->slot];
+			YY_DIRN* d = &dir->buffer->entry[dir->slot];
 			if(d->DIR_Name[0]==0xe5){
 //				printf("%3d   unused entry\n", i+1);
 			}
 			else if(d->DIR_Name[0]==0){
 //				printf("%3d   end of directory\n", i+1);
+				dir->bEnd = true;
 				return nullptr;
 			}
 			else if((d->DIR_Attr & 0x0f)==0x0f){
 //				printf("long filename text\n");
-				UnpackLong(file, d);
+				if(d->DIR_Name[0] & 0x40){		// first of a long name so the item starts here
+					file->dirSector = dir->sector;
+					file->dirSlot	= dir->slot;
+				}
+				UnpackLong(dir, d);
 			}
 			else{
+				if(dir->itemName[0]==0 || file->dirSector==0){	// no long name so the item starts here
+					file->dirSector = dir->sector;
+					file->dirSlot	= dir->slot;
+				}
 				file->startCluster = ((uint32_t)d->DIR_FstClusHI<<16) | d->DIR_FstClusLO;
 
-				if(file->longName[0]==0)											// do we have a long file name accumulated
-					MakeLongFromShort(d->DIR_Name, file->longName, d->DIR_NTRes);	// No, so build one
+				if(dir->itemName[0]==0)												// do we have a long file name accumulated
+					MakeLongFromShort(d->DIR_Name, dir->itemName, d->DIR_NTRes);	// No, so build one
 				else{
-#pragma warning( push )
-#pragma warning(disable: 6201 )			// yes I know but they're together
-					uint8_t csum = 0;
-					for(int i=0; i<11; ++i)		// page 32
-						csum = ((csum & 1) ? 0x80 : 0) + (csum >> 1) + d->DIR_Name[i];
-					if(csum != file->shortnamechecksum)
+					if(shortChecksum(d->DIR_Name) != dir->checksum)	// page 32
 						printf("LongName checksum error type 2\n");
-#pragma warning( pop )
 				}
-				memcpy(&file->dirn, d, sizeof YY_DIRN);								// copy in verbatim
-				file->filePointer = 0;
+				file->entrySector = dir->sector;
+				file->entrySlot	  = dir->slot;
+				memcpy(&file->dirn, d, sizeof(YY_DIRN));								// copy in verbatim
 				++dir->slot;					// ready for next time
-				file->drive = dir->drive;		// until we do this the slot is not ours.
-				memcpy(file->pathName, dir->longPath, MAX_PATH);
-//				file->dir = dir;
-				return file;
+				file->drive = dir->drive;
+				return keepNames(dir, file) ? file : nullptr;
 			}
 			++dir->slot;
 		}
 	}
 }
+// nullptr at the end and if it fails, dir->bEnd says which
+YY_FILE* YY_NextDirectoryItem(YY_DIRECTORY* dir)
+{
+	dir->bEnd = false;
+	YY_FILE* file = YY_GetFileSlot();
+	if(file==nullptr) return nullptr;
+	bool ok = nextItem(dir, file)!=nullptr;
+	unloadSector(dir);
+	if(!ok){
+		YY_FreeFileSlot(file);			// the pool wants it back
+		return nullptr;
+	}
+	return file;
+}
+//-------------------------------------------------------------------------------------------------
+// Batch reading
+// A listing doesn't need a YY_FILE for every item so this fills your array with the short entry
+// and the name of as many items as fit, taking each sector as it comes rather than an item at a
+// time. The names go in your buffer, one after the other. Carry on calling it until it gives you
+// nothing, an item whose name doesn't fit is left for next time unless it's the first in which case
+// you get as much of its name as there is room for so 0 is only ever the end.
+// It doesn't go through the cache a sector at a time either. As much of the directory as carries on
+// without a break from where we are (up to YY_DIR_WINDOW sectors) comes in one read into a window of
+// its own, and that is thrown away if we change any directory on the drive in the meantime.
+//-------------------------------------------------------------------------------------------------
+static YY_DIRSECT* windowSector(YY_DIRECTORY* dir)
+{
+	YY_DRIVE* drive = dir->drive;
+	if(dir->windowStamp==drive->dirWrites && dir->sector>=dir->windowSector
+			&& dir->sector<dir->windowSector+dir->windowCount)
+		return &dir->window[dir->sector - dir->windowSector];
+	if(dir->window==nullptr){
+		dir->window = (YY_DIRSECT*)XX_alloc(YY_DIR_WINDOW*sizeof(YY_DIRSECT));
+		if(dir->window==nullptr) return nullptr;
+	}
+	uint32_t n;
+	if(dir->sector < drive->cluster_begin_sector)			// FAT12/16 root directory is all in one
+		n = drive->cluster_begin_sector - dir->sector;
+	else{													// the rest of this cluster and those straight after it
+		uint32_t perCluster = drive->sectors_in_cluster_mask+1;
+		n = perCluster - (dir->sector & drive->sectors_in_cluster_mask);
+		if(n<YY_DIR_WINDOW)
+			n += YY_ChainRun(drive, YY_SectorToCluster(drive, dir->sector),
+							 (YY_DIR_WINDOW-n+perCluster-1)/perCluster) * perCluster;
+	}
+	if(n>YY_DIR_WINDOW) n = YY_DIR_WINDOW;
+	dir->windowCount = 0;
+	if(!YY_ReadSectors(drive->hDevice, dir->sector, n, dir->window)) return nullptr;
+	dir->windowSector = dir->sector;
+	dir->windowCount  = (uint16_t)n;
+	dir->windowStamp  = drive->dirWrites;
+	return dir->window;
+}
+static bool isDots(YY_DIRN* d)
+{
+	return d->DIR_Name[0]=='.' && (d->DIR_Name[1]==' ' || (d->DIR_Name[1]=='.' && d->DIR_Name[2]==' '));
+}
+static uint16_t emptyName[1];					// for a name cut short to nothing
+uint16_t YY_ReadDirectory(YY_DIRECTORY* dir, YY_DIRENTRY* out, uint16_t max, uint16_t* names, uint16_t cbNames, uint8_t flags)
+{
+	uint16_t n = 0, used = 0;
+	bool bLong = false;							// we are part way through a long name
+	uint32_t itemSector = dir->sector;
+	uint8_t itemSlot = dir->slot;
+	while(n<max){
+		if(dir->slot>=16){
+			uint32_t next = dir->sector+1;		// no need to ask the FAT inside the window
+			if(next>=dir->windowSector+dir->windowCount || next<dir->windowSector)
+				next = YY_GetNextSector(dir->drive, dir->sector);
+			if(next==0) break;					// end of the chain
+			dir->sector = next;
+			dir->slot	= 0;
+		}
+		YY_DIRSECT* sect = windowSector(dir);
+		if(sect==nullptr) break;
+		for(; dir->slot<16; ++dir->slot){
+			YY_DIRN* d = &sect->entry[dir->slot];
+			if(!bLong){
+				itemSector = dir->sector;
+				itemSlot   = dir->slot;
+			}
+			if(d->DIR_Name[0]==0)				// end of directory and we stay here
+				return n;
+			if(d->DIR_Name[0]==0xe5){			// unused, and anything long before it was orphaned
+				bLong = false;
+				continue;
+			}
+			if((d->DIR_Attr & 0x0f)==0x0f){
+				if(!(flags & RDF_SHORTNAMES))
+					UnpackLong(dir, d);
+				bLong = true;
+				continue;
+			}
+			bool bHadLong = bLong;
+			bLong = false;
+			if((flags & RDF_NOHIDDEN) && (d->DIR_Attr & (ATTR_HIDE | ATTR_SYS))) continue;
+			if((flags & RDF_NODOTS) && isDots(d)) continue;
+
+			uint16_t* name = dir->itemName;
+			uint16_t text[SHORTNAME];
+			if(!bHadLong || (flags & RDF_SHORTNAMES) || dir->checksum!=shortChecksum(d->DIR_Name)
+					|| dir->itemName[0]==0)
+				MakeLongFromShort(d->DIR_Name, name = text, d->DIR_NTRes);
+			uint16_t len = YY_WideLen(name)+1;
+			if(used+len > cbNames){
+				if(n){							// no room so start with this one next time
+					dir->sector = itemSector;
+					dir->slot	= itemSlot;
+					return n;
+				}
+				len = cbNames;					// it's the first so cut the name short
+			}
+			memcpy(&out[n].dirn, d, sizeof(YY_DIRN));
+			out[n].name		 = len ? names+used : emptyName;
+			out[n].dirSector = itemSector;
+			out[n].dirSlot	 = itemSlot;
+			if(len){
+				memcpy(names+used, name, (len-1)*sizeof(uint16_t));
+				names[used+len-1] = 0;
+			}
+			used += len;
+			if(++n==max){
+				++dir->slot;
+				break;
+			}
+		}
+	}
+	return n;
+}
+// put an item back so the next read starts with it
+void YY_UnreadDirectory(YY_DIRECTORY* dir, YY_DIRENTRY* entry)
+{
+	dir->sector = entry->dirSector;
+	dir->slot	= entry->dirSlot;
+}
+// make the YY_FILE for an item we read, you own it, and the directory carries on where it was
+YY_FILE* YY_DirectoryItemAt(YY_DIRECTORY* dir, YY_DIRENTRY* entry)
+{
+	uint32_t sector = dir->sector;
+	uint8_t slot = dir->slot;
+	dir->sector = entry->dirSector;
+	dir->slot	= entry->dirSlot;
+	YY_FILE* file = YY_NextDirectoryItem(dir);
+	dir->sector = sector;
+	dir->slot	= slot;
+	return file;
+}
+//-------------------------------------------------------------------------------------------------
+// Making new items
+// A name that is a valid 8.3 name in one case gets just a short entry. Anything else gets a
+// NAME~N.EXT short name that isn't already in use and the long name in front of it.
+//-------------------------------------------------------------------------------------------------
+static bool validShortChar(uint16_t c)
+{
+	if(c<=' ' || c>=0x7f) return false;
+	for(const char* p = "\"*+,./:;<=>?[\\]|"; *p; ++p)
+		if(c==(uint8_t)*p) return false;
+	return true;
+}
+// make the 8.3 name, returns the DIR_NTRes case bits or 0xff if it needs a long name (and a ~N tail)
+static uint8_t makeShortName(uint16_t* name, uint8_t* shortName)
+{
+	memset(shortName, ' ', 11);
+	uint16_t len = YY_WideLen(name);
+	int dot = -1;										// the last dot starts the extension
+	for(int i=len-1; i>0; --i)
+		if(name[i]=='.'){ dot = i; break; }
+
+	bool bLossy = false;
+	uint8_t upper=0, lower=0;							// case seen in the name (1) and extension (2)
+	int j=0, i=0;
+	while(name[i]=='.' || name[i]==' '){ bLossy = true; ++i; }	// leading dots and spaces go
+	for( ; name[i] && i!=dot; ++i){
+		uint16_t c = name[i];
+		if(c==' ' || c=='.'){ bLossy = true; continue; }
+		if(j==8){ bLossy = true; continue; }
+		if(!validShortChar(c)){ bLossy = true; c = '_'; }
+		if(c>='a' && c<='z'){ lower |= 1; c -= 'a'-'A'; }
+		else if(c>='A' && c<='Z') upper |= 1;
+		shortName[j++] = (uint8_t)c;
+	}
+	if(dot>=0)
+		for(i=dot+1, j=8; name[i]; ++i){
+			uint16_t c = name[i];
+			if(c==' '){ bLossy = true; continue; }
+			if(j==11){ bLossy = true; break; }
+			if(!validShortChar(c)){ bLossy = true; c = '_'; }
+			if(c>='a' && c<='z'){ lower |= 2; c -= 'a'-'A'; }
+			else if(c>='A' && c<='Z') upper |= 2;
+			shortName[j++] = (uint8_t)c;
+		}
+	if(shortName[0]==0xe5) shortName[0] = 0x05;		// that means deleted
+	if(bLossy || (upper & lower) || shortName[0]==' ') return 0xff;
+	return ((lower & 1) ? 0x08 : 0) | ((lower & 2) ? 0x10 : 0);
+}
+static uint8_t shortChecksum(uint8_t* shortName)
+{
+	uint8_t csum = 0;
+	for(int i=0; i<11; ++i)
+		csum = ((csum & 1) ? 0x80 : 0) + (csum >> 1) + shortName[i];
+	return csum;
+}
+// step on to the next directory entry, extending the directory if bGrow and we run off the end
+static bool nextEntry(YY_DIRECTORY* dir, uint32_t* sector, uint8_t* slot, bool bGrow)
+{
+	if(++*slot<16) return true;
+	*slot = 0;
+	YY_DRIVE* drive = dir->drive;
+	uint32_t next = YY_GetNextSector(drive, *sector, true);		// we're changing it so the drive is ours
+	if(next==0 && bGrow && *sector>=drive->cluster_begin_sector){	// FAT12/16 roots can't grow
+		uint32_t c = YY_AllocateCluster(drive);
+		if(c==0) return false;
+		YY_SetClusterEntry(drive, YY_SectorToCluster(drive, *sector), c);
+		next = YY_ClusterToSector(drive, c);
+		for(uint32_t i=0; i<=drive->sectors_in_cluster_mask; ++i){	// a new cluster is all 'end of directory'
+			uint8_t* data = YY_GetSector(drive->hDevice, next+i, false);
+			if(data==nullptr) return false;
+			memset(data, 0, 512);
+			YY_ReleaseSector(data, true);
+			++drive->dirWrites;
+		}
+	}
+	*sector = next;
+	return next!=0;
+}
+// find n consecutive free entries
+static bool findFreeEntries(YY_DIRECTORY* dir, uint8_t n, uint32_t* first, uint8_t* firstSlot)
+{
+	YY_ResetDirectory(dir);
+	uint32_t sector = dir->sector;
+	uint8_t slot = 0, run = 0;
+	while(true){
+		YY_DIRN* d = (YY_DIRN*)YY_GetSector(dir->drive->hDevice, sector);
+		if(d==nullptr) return false;
+		uint8_t c = d[slot].DIR_Name[0];
+		YY_ReleaseSector(d);
+		if(c==0xe5 || c==0){
+			if(run++==0){
+				*first	   = sector;
+				*firstSlot = slot;
+			}
+			if(run==n) return true;
+		}
+		else
+			run = 0;
+		if(!nextEntry(dir, &sector, &slot, true)) return false;	// off the end so add a cluster
+	}
+}
+static bool putEntry(YY_DIRECTORY* dir, uint32_t* sector, uint8_t* slot, void* entry, bool bLast)
+{
+	YY_DIRN* d = (YY_DIRN*)YY_GetSector(dir->drive->hDevice, *sector);
+	if(d==nullptr) return false;
+	memcpy(&d[*slot], entry, sizeof(YY_DIRN));
+	YY_ReleaseSector(d, true);
+	++dir->drive->dirWrites;
+	return bLast || nextEntry(dir, sector, slot, false);
+}
+// Make a new item called name in dir, you own the YY_FILE you get back
+YY_FILE* YY_CreateItem(YY_DIRECTORY* dir, uint16_t* name, uint8_t attr)
+{
+	uint16_t len = YY_WideLen(name);
+	if(len==0 || len>255) return nullptr;
+	for(uint16_t i=0; i<len; ++i)
+		if(name[i]<' ' || (name[i]<0x80 && strchr("\"*/:<>?\\|", name[i])))
+			return nullptr;
+
+	uint8_t shortName[11];
+	uint8_t ntres = makeShortName(name, shortName);
+	uint8_t nLong = 0;
+	if(ntres==0xff){									// we need a long name and a unique short one
+		ntres = 0;
+		nLong = (uint8_t)((len+12)/13);
+		uint8_t base = 0;
+		while(base<8 && shortName[base]!=' ') ++base;
+		uint16_t n;
+		for(n=1; n<10000; ++n){
+			char tail[8];
+			int t = snprintf(tail, sizeof tail, "~%u", n);
+			uint8_t k = base+t>8 ? 8-t : base;
+			memcpy(shortName+k, tail, t);
+			uint16_t candidate[13];
+			MakeLongFromShort(shortName, candidate, 0);
+			YY_FILE* file = YY_FindDirectoryItem(dir, candidate);
+			if(file==nullptr) break;
+			YY_FreeFileSlot(file);
+		}
+		if(n==10000) return nullptr;
+	}
+
+	uint32_t sector;
+	uint8_t slot;
+	if(!findFreeEntries(dir, nLong+1, &sector, &slot)) return nullptr;
+	uint32_t firstSector = sector;
+	uint8_t firstSlot = slot;
+
+	uint8_t csum = shortChecksum(shortName);
+	for(uint8_t k=nLong; k>0; --k){						// long name pieces last first
+		DIRL l{};
+		l.LDIR_Ord	  = k | (k==nLong ? 0x40 : 0);
+		l.LDIR_attr	  = 0x0f;
+		l.LDIR_ChkSum = csum;
+		uint16_t chars[13];
+		for(int j=0; j<13; ++j){
+			uint16_t i = (k-1)*13+j;
+			chars[j] = i<len ? name[i] : i==len ? 0 : 0xffff;
+		}
+		memcpy(l.LDIR_Name1, chars,	  5*2);
+		memcpy(l.LDIR_Name2, chars+5, 6*2);
+		memcpy(l.LDIR_Name3, chars+11, 2*2);
+		if(!putEntry(dir, &sector, &slot, &l, false)) return nullptr;
+	}
+	YY_DIRN d{};
+	memcpy(d.DIR_Name, shortName, 11);
+	d.DIR_Attr	= attr;
+	d.DIR_NTRes = ntres;
+	XX_GetDateTime(&d.DIR_CrtDate, &d.DIR_CrtTime);
+	d.DIR_WrtDate = d.DIR_LstAccDate = d.DIR_CrtDate;
+	d.DIR_WrtTime = d.DIR_CrtTime;
+	if(!putEntry(dir, &sector, &slot, &d, true)) return nullptr;
+
+	// and read it back so it is just like one we found
+	dir->sector	   = firstSector;
+	dir->slot	   = firstSlot;
+	dir->readAhead = 0;
+	YY_FILE* file = YY_NextDirectoryItem(dir);
+	if(file) YY_NameAdded(dir, file);
+	return file;
+}
+// write an item's short entry back after changing its dirn
+bool YY_UpdateItem(YY_FILE* file)
+{
+	YY_DIRN* d = (YY_DIRN*)YY_GetSector(file->drive->hDevice, file->entrySector);
+	if(d==nullptr) return false;
+	memcpy(&d[file->entrySlot], &file->dirn, sizeof(YY_DIRN));
+	YY_ReleaseSector(d, true);
+	++file->drive->dirWrites;
+	return true;
+}
 // close a whole directory tree
 void YY_CloseDirectory(YY_DIRECTORY* dir)
 {
-	dir->drive = 0;
+	FreeDirectorySlot(dir);
 }
 //=================================================================================================
 // text description of YY_FILE
 //=================================================================================================
-static const char* makeTime(uint16_t time)
+#define STAMPTEXT	15						// "hh:mm:ss" or "yyyy/mm/dd" with room to spare
+static const char* makeTime(uint16_t time, char* temp)	// temp[STAMPTEXT]
 {
-	static char temp[15];
 	int seconds = time & 0x1f;
 	time >>= 5;
 	int minutes = time & 0x3f;
 	time >>= 6;
 	int hours = time & 0x1f;
-	sprintf_s(temp, sizeof temp, "%02d:%02d:%02d", hours, minutes, seconds*2);
+	sprintf_s(temp, STAMPTEXT, "%02d:%02d:%02d", hours, minutes, seconds*2);
 	return temp;
 }
-static const char* makeDate(uint16_t date)
+static const char* makeDate(uint16_t date, char* temp)
 {
-	static char temp[15];
 	int day = date & 0x1f;
 	date >>= 5;
 	int month = date & 0xf;
 	date >>= 4;
 
 	int year = date & 0x7f;
-	sprintf_s(temp, sizeof temp, "%04d/%02d/%02d", year+1980, month, day);
+	sprintf_s(temp, STAMPTEXT, "%04d/%02d/%02d", year+1980, month, day);
 	return temp;
 }
 const char* YY_WriteDirectoryItem(YY_FILE* file, uint8_t* buffer, int cb)
 {
 	uint8_t temp[MAX_PATH];
+	char date[STAMPTEXT], time[STAMPTEXT], flags[7];
 	sprintf_s((char*)buffer, cb, "%10s %10s  %6s %8u  %10" PRIu32 "   %s",
-			makeDate(file->dirn.DIR_WrtDate), makeTime(file->dirn.DIR_WrtTime), MakeFlags(file->dirn.DIR_Attr),
+			makeDate(file->dirn.DIR_WrtDate, date), makeTime(file->dirn.DIR_WrtTime, time), MakeFlags(file->dirn.DIR_Attr, flags),
 			file->dirn.DIR_FileSize, file->startCluster,
 			YY_ToNarrow(temp, sizeof temp, file->longName));
 	return (char*)buffer;
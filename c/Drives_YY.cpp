@@ -4,13 +4,20 @@
 
 #include <cstdio>
 #include <cstdint>
+#include <cstring>
+#include <cstdlib>
+#include <cctype>
 #include <cassert>
 #include <inttypes.h>		// see: https://en.cppreference.com/w/cpp/types/integer for printf'ing silly things
-#include <windows.h>
+#include "FAT_OS.h"		// <windows.h> or the bits of it we need
 
 #include "FAT_XX.h"
 #include "FAT_YY.h"
 
+#if defined(_MSC_VER)
+#pragma warning( disable: 4996 )	// fopen(), sscanf() and getenv() are what both platforms have
+#endif
+
 //=================================================================================================
 //
 // This file provides
@@ -26,50 +33,138 @@
 // definitions for the various drives
 YY_DRIVE	yy_drives[N_DRIVES]{};
 
+// Each drive's reader/writer lock and the lock on its FAT buffers (see YY_THREADS). They live out
+// here as the locks want their natural alignment and YY_DRIVE is packed. Mounting, unmounting and
+// the drive map have one lock between them, taken after a drive's lock if both are needed.
+#pragma pack(push, 8)
+struct DRIVELOCKS {
+	XX_LOCK		drive = XX_LOCK_INIT;
+	XX_LOCK		fat	  = XX_LOCK_INIT;
+};
+#pragma pack(pop)
+static DRIVELOCKS	driveLocks[N_DRIVES];
+static XX_LOCK		mountLock = XX_LOCK_INIT;
+
 // the default device tells us which devices cwd to use
 uint8_t	YY_defaultDrive = 'C';
 
+// The table of drive letters to devices. The built in entries can be replaced or added to by a
+// configuration file, named by the FAT_DRIVES environment variable or "fatdrives.cfg", which is read
+// on the first mount. One drive per line, partitions count from 1, # starts a comment:
+//		C	/dev/sdb			1
+//		D	/dev/sdb			2	direct
+//		A	images/floppy.img	1	mapped
+#define N_MAPS			8		// max drive definitions
+
 struct MAP {
 	uint8_t			id;
-	const uint8_t	device[25];
+	char			device[MAX_PATH];
 	uint8_t			partition;
-} map[] {
-	{	'A',	"\\\\.\\A:",			 0 },		// floppy default
-	{	'B',	"\\\\.\\B:",			 1 },		// my floppy isn't partitioned
-	{	'C',	"\\\\.\\PhysicalDrive2", 0 },		// SD card partition 1
-	{	'D',	"\\\\.\\PhysicalDrive2", 1 },		// SD card partition 2
-	{	'E',	"\\\\.\\PhysicalDrive2", 2 },		// SD card partition 3
-	{	'F',	"\\\\.\\PhysicalDrive2", 3 }		// SD card partition 4
+	uint8_t			flags;			// XX_OpenDevice() flags
+} map[N_MAPS] {
+#if defined(_WIN32)
+	{	'A',	"\\\\.\\A:",			 0, 0 },		// floppy default
+	{	'B',	"\\\\.\\B:",			 1, 0 },		// my floppy isn't partitioned
+	{	'C',	"\\\\.\\PhysicalDrive2", 0, 0 },		// SD card partition 1
+	{	'D',	"\\\\.\\PhysicalDrive2", 1, 0 },		// SD card partition 2
+	{	'E',	"\\\\.\\PhysicalDrive2", 2, 0 },		// SD card partition 3
+	{	'F',	"\\\\.\\PhysicalDrive2", 3, 0 }		// SD card partition 4
+#endif
 };
+static bool bMapLoaded{};
 
 //-------------------------------------------------------------------------------------------------
-// Read the  partition definitions et al.
-// That is in sector 0 of the SD card but floppies normally don't do partitions so beware...
+// Define (or redefine) what a drive letter means, partition counts from 0
 //-------------------------------------------------------------------------------------------------
-struct BOOT_SECTOR {
-	uint8_t jmp[3];
-	uint8_t test[8];					// if this says "MSDOS5.0" think floppy with no partition table
-	uint8_t	fill[435];					// this is where the 'boot' code goes
-	struct PARTITION {					// partition table
-			uint8_t		BootFlag;
-			uint24_t	CHS_Begin;
-			uint8_t		Type_Code;
-			uint24_t	CHS_End;
-			uint32_t	LBA_Begin;
-			uint32_t	nSectors;
-	} Partitions[4];
-	uint8_t sig1;
-	uint8_t sig2;
-};
+static bool mapDrive(uint8_t idDrive, const char* device, uint8_t partition, uint8_t flags)
+{
+	idDrive = (uint8_t)toupper(idDrive);
+	MAP* m = nullptr;
+	for(int i=0; i<N_MAPS; ++i)
+		if(map[i].id==idDrive){
+			m = &map[i];
+			break;
+		}
+	if(m==nullptr)
+		for(int i=0; i<N_MAPS; ++i)
+			if(map[i].id==0){
+				m = &map[i];
+				break;
+			}
+	size_t cb = strlen(device);
+	if(m==nullptr || cb>=MAX_PATH) return false;
+	m->id = idDrive;
+	memcpy(m->device, device, cb+1);
+	m->partition = partition;
+	m->flags	 = flags;
+	return true;
+}
+bool YY_MapDrive(uint8_t idDrive, const char* device, uint8_t partition, uint8_t flags)
+{
+	YY_Lock(&mountLock);
+	bool ret = mapDrive(idDrive, device, partition, flags);
+	YY_Unlock(&mountLock);
+	return ret;
+}
+//-------------------------------------------------------------------------------------------------
+// Read a configuration file of drive definitions, returns how many it took or -1 if no file
+//-------------------------------------------------------------------------------------------------
+static int loadDriveMap(const char* fileName)
+{
+	bMapLoaded = true;
+	FILE* fp = fopen(fileName, "r");
+	if(fp==nullptr) return -1;
+
+	int n=0, line=0;
+	char text[MAX_PATH+40], device[MAX_PATH], option[20];
+	while(fgets(text, sizeof text, fp)){
+		++line;
+		char* hash = strchr(text, '#');
+		if(hash) *hash = 0;
+		char id;
+		int partition = 1;
+		option[0] = 0;
+		char fmt[40];
+		snprintf(fmt, sizeof fmt, " %%c %%%ds %%d %%19s", MAX_PATH-1);
+		int c = sscanf(text, fmt, &id, device, &partition, option);
+		if(c<=0) continue;						// blank line
+		uint8_t flags = 0;
+		if(strcmp(option, "direct")==0) flags |= XX_DIRECT;
+		else if(strcmp(option, "mapped")==0) flags |= XX_MAPPED;
+		else if(option[0]) c = 0;
+		if(c<2 || !isalpha((uint8_t)id) || partition<1 || partition>4
+				|| !mapDrive((uint8_t)id, device, (uint8_t)(partition-1), flags)){
+			printf("%s line %d: bad drive definition\n", fileName, line);
+			continue;
+		}
+		++n;
+	}
+	fclose(fp);
+	return n;
+}
+int YY_LoadDriveMap(const char* fileName)
+{
+	YY_Lock(&mountLock);
+	int n = loadDriveMap(fileName);
+	YY_Unlock(&mountLock);
+	return n;
+}
+
+// partition types we can mount: FAT12, FAT16 (small and big) and FAT32 (CHS and LBA) and FAT16 LBA
+bool YY_isFatPartition(uint8_t type)
+{
+	return type==0x01 || type==0x04 || type==0x06 || type==0x0b || type==0x0c || type==0x0e;
+}
 //-------------------------------------------------------------------------------------------------
-// read the boot sector
+// Read the  partition definitions et al.
+// That is in sector 0 of the SD card but floppies normally don't do partitions so beware...
 // return 0==error, 1=it read OK but this is not a partition table, 2 = good partition stuff
 //--------------------------------------------------------------------------------------------------
 static int ReadBootSector(HANDLE hDevice, BOOT_SECTOR* boot)
 {
-	assert(sizeof BOOT_SECTOR==512);
+	assert(sizeof(BOOT_SECTOR)==512);
 
-	if(!XX_ReadSector(hDevice, 0, (LPVOID)boot)) return false;
+	if(!YY_ReadSector(hDevice, 0, (LPVOID)boot)) return false;
 //	dump(boot, 512);
 	if(boot->sig1!=0x55 || boot->sig2!=0xaa){
 		printf("Bad signature in BOOT SECTOR.  ");
@@ -98,55 +193,48 @@ static int ReadBootSector(HANDLE hDevice, BOOT_SECTOR* boot)
 // MountDrive() aka Read the FAT12/16/32 partition first sector
 //-------------------------------------------------------------------------------------------------
 
-// I experimented with more readable names but it makes it a lot easier to read the Microsoft documentation keeping their mangled 14 character names
-struct FAT_VOL_ID {
-	uint8_t		BS_jmpBoot[3];					// 0
-	uint8_t		BS_OEMName[8];					// 3
-	uint16_t	BPB_BytsPerSec;					// 11 Bytes per Sector, normally 512 but could be 512,1024,2048, 4096
-	uint8_t		BPB_SecPerClus;					// 13 Sectors per Cluster, always a power of two (1,2,4...128)
-	uint16_t	BPB_RsvdSecCnt;					// 14 Number of Reserved Sectors, if none needed is used to pad the data area start to a cluster
-	uint8_t		BPB_NumFATs;					// 16 Number of FATs, always 2 although 1 is officially allowed
-	uint16_t	BPB_RootEntCnt;					// 17 number of entries in root dir, FAT12/16 only with fixed root directory
-	uint16_t	BPB_TotSec16;					// 19 total sectors, FAT12/16 only
-	uint8_t		BPB_Media;						// 21 Media type
-	uint16_t	BPB_FATSz16;					// 22 SectorPer FAT 12/16
-	uint16_t	BPB_SecPerTrk;					// 24 Sectors Per Track, only relevant to devices that care
-	uint16_t	BPB_NumHeads;					// 26 Number of heads, ditto
-	uint32_t	BPB_HiddSec;					// 28 zero
-	uint32_t	BPB_TotSec32;					// 32 number of sectors, FAT32 only
-	union{
-		// FAT12/16 version
-		struct{
-			uint8_t		BS_DrvNum;				// 36
-			uint8_t		BS_Reserved1;			// 37
-			uint8_t		BS_BootSig;				// 38
-			uint32_t	BS_VolID;				// 39
-			uint8_t		BS_VolLab[11];			// 43
-			uint8_t		BS_FilSysType[8];		// 54
-			uint8_t		fill1[448];				// 62
-		};
-		// FAT32 version
-		struct{
-			uint32_t	BPB_FATSz32;			// 36 Sectors Per FAT
-			uint16_t	BPB_ExtFlags;			// 40
-			uint16_t	BPB_FSVer;				// 42 must be zero
-			uint32_t	BPB_RootClus;			// 44 Root Directory First Cluster
-			uint16_t	BPB_FSInfo;				// 48
-			uint16_t	BPB_BkBootSec;			// 50 0 or 6
-			uint8_t		BPB_Reserved[12];		// 52 zeros
-			uint8_t		BS_DrvNum32;			// 64 (name not Microsoft due to duplication in FAT12/16)
-			uint8_t		BS_Reserved1_32;		// 65 (ditto)
-			uint8_t		BS_BootSig32;			// 66 (ditto)
-			uint32_t	BS_VolID32;				// 67 (ditto)
-			uint8_t		BS_VolLab32[11];		// 71 (ditto)
-			uint8_t		BS_FilSysType32[8];		// 82 (ditto)
-			uint8_t		fill2[420];				// 90
-		};
-	};
-	uint8_t		sig1;							// 510 0x55
-	uint8_t		sig2;							// 511 0xaa
-};
+static bool goodFSInfo(FAT_FSINFO* fsi)
+{
+	return fsi->FSI_LeadSig==0x41615252 && fsi->FSI_StrucSig==0x61417272 && fsi->FSI_TrailSig==0xaa550000;
+}
+//-------------------------------------------------------------------------------------------------
+// Read the FSInfo sector and take its hints if they look sane
+//-------------------------------------------------------------------------------------------------
+static void ReadFSInfo(YY_DRIVE* drive, uint16_t BPB_FSInfo)
+{
+	assert(sizeof(FAT_FSINFO)==512);
 
+	drive->fsinfo_sector = 0;
+	if(BPB_FSInfo==0 || BPB_FSInfo==0xffff) return;
+	FAT_FSINFO* fsi = (FAT_FSINFO*)YY_GetSector(drive->hDevice, drive->partition_begin_sector + BPB_FSInfo);
+	if(fsi==nullptr) return;
+	if(goodFSInfo(fsi)){
+		drive->fsinfo_sector = drive->partition_begin_sector + BPB_FSInfo;
+		if(fsi->FSI_Free_Count <= drive->count_of_clusters)
+			drive->free_clusters = fsi->FSI_Free_Count;
+		if(fsi->FSI_Nxt_Free>=2 && fsi->FSI_Nxt_Free < drive->count_of_clusters+2){
+			drive->next_free		= fsi->FSI_Nxt_Free;
+			drive->fat_free_speedup	= fsi->FSI_Nxt_Free/128;
+		}
+	}
+	YY_ReleaseSector(fsi);
+}
+//-------------------------------------------------------------------------------------------------
+// Put our free space numbers back into the FSInfo sector (only writes if they changed)
+//-------------------------------------------------------------------------------------------------
+void YY_UpdateFSInfo(YY_DRIVE* drive)
+{
+	if(drive->fsinfo_sector==0) return;
+	FAT_FSINFO* fsi = (FAT_FSINFO*)YY_GetSector(drive->hDevice, drive->fsinfo_sector);
+	if(fsi==nullptr) return;
+	bool dirty = false;
+	if(goodFSInfo(fsi) && (fsi->FSI_Free_Count!=drive->free_clusters || fsi->FSI_Nxt_Free!=drive->next_free)){
+		fsi->FSI_Free_Count = drive->free_clusters;		// 0xffffffff if we don't know either
+		fsi->FSI_Nxt_Free	= drive->next_free;
+		dirty = true;
+	}
+	YY_ReleaseSector(fsi, dirty);
+}
 
 // convert division by n where n is a power of two into >>m (which is far more Z80 friendly)
 static uint8_t toSlide(uint8_t n)
@@ -158,9 +246,9 @@ static uint8_t toSlide(uint8_t n)
 	}
 	return i;
 }
-YY_DRIVE* YY_MountDrive(uint8_t idDevice)
+static YY_DRIVE* mountDrive(uint8_t idDevice)
 {
-	assert(sizeof FAT_VOL_ID==512);
+	assert(sizeof(FAT_VOL_ID)==512);
 
 	// are they asking for a device we already have?
 	int n;						// index for devices
@@ -178,15 +266,19 @@ YY_DRIVE* YY_MountDrive(uint8_t idDevice)
 
 	// we have a slot but does the request make sense?
 	// check if we have a definition for this in as map[]
+	if(!bMapLoaded){
+		const char* cfg = getenv("FAT_DRIVES");
+		loadDriveMap(cfg ? cfg : "fatdrives.cfg");
+	}
 	int m;							// index for maps
-	for(m=0; m < _countof(map); ++m)
+	for(m=0; m < N_MAPS; ++m)
 		if(map[m].id==idDevice)
 			break;
-	if(m==_countof(map)) return nullptr;	// unknown device
+	if(m==N_MAPS) return nullptr;	// unknown device
 
 	// OK but does it exist now?
 	// ie: is there a disk in the drive of a card in the slot?
-	drive->hDevice = XX_OpenDevice((char*)map[m].device);
+	drive->hDevice = XX_OpenDevice(map[m].device, map[m].flags);
 	if(drive->hDevice == INVALID_HANDLE_VALUE){
 		// error message for Windows technology demonstrator
 		printf("Open failed.  ARE YOU IN ADMINISTRATOR MODE? ARE YOU USING 'THE RIGHT' ADAPTER?\n");
@@ -194,8 +286,7 @@ YY_DRIVE* YY_MountDrive(uint8_t idDevice)
 		return nullptr;
 	}
 
-	BOOT_SECTOR* boot = (BOOT_SECTOR*)drive->fatTable;	// I can use this as it isn't needed yet
-	bool bNoPartitions{};								// set if there is no partition table and this is sector zero
+	BOOT_SECTOR* boot = (BOOT_SECTOR*)drive->fatBuffers[0].fatTable;	// I can use this as it isn't needed yet
 
 	int res = ReadBootSector(drive->hDevice, boot);		// what sort of boot sector do we have?
 	if(res==0){					// 0 = error
@@ -214,7 +305,7 @@ YY_DRIVE* YY_MountDrive(uint8_t idDevice)
 	if(res==2){		// if partitioned
 		drive->partition_begin_sector = boot->Partitions[map[m].partition].LBA_Begin;
 		BOOT_SECTOR::PARTITION *p = &boot->Partitions[map[m].partition];
-		if(p->Type_Code!=0x01 && p->Type_Code!=0x04 && (p->Type_Code!=0x0c)){
+		if(!YY_isFatPartition(p->Type_Code)){
 			printf("Partition %d not FAT12/16/32\n", map[m].partition+1);
 			return nullptr;
 		}
@@ -223,9 +314,9 @@ YY_DRIVE* YY_MountDrive(uint8_t idDevice)
 		drive->partition_begin_sector = 0;
 
 	// Now we are setting up a FAT
-	FAT_VOL_ID* volID = (FAT_VOL_ID*)drive->fatTable;	// finished with boot so reuse the buffer
+	FAT_VOL_ID* volID = (FAT_VOL_ID*)drive->fatBuffers[0].fatTable;	// finished with boot so reuse the buffer
 
-	if(!XX_ReadSector(drive->hDevice, drive->partition_begin_sector, volID)){
+	if(!YY_ReadSector(drive->hDevice, drive->partition_begin_sector, volID)){
 		printf("Failed to read sector %u for partition ID\n", drive->partition_begin_sector);
 		return nullptr;
 	}
@@ -263,19 +354,46 @@ YY_DRIVE* YY_MountDrive(uint8_t idDevice)
 		drive->fat_type = FAT16;
 	else
 		drive->fat_type = FAT32;
+	YY_SetFatOps(drive);
 
 	// now generate the rest of our working variables
 	drive->sectors_to_cluster_right_slide	= toSlide(volID->BPB_SecPerClus);		// divide by a power of two
 	drive->sectors_in_cluster_mask			= volID->BPB_SecPerClus-1;				// eg: convert 32 into 31 aka 0x1f to get remainders
 	drive->fat_begin_sector					= drive->partition_begin_sector + volID->BPB_RsvdSecCnt;
+	drive->fat_copies						= volID->BPB_NumFATs;
+	if(drive->fat_type==FAT32 && (volID->BPB_ExtFlags & 0x80)){		// mirroring off so only one FAT is live
+		drive->fat_begin_sector			   += (volID->BPB_ExtFlags & 0x0f) * drive->fat_size;
+		drive->fat_copies					= 1;
+	}
 	drive->root_dir_first_sector			= drive->partition_begin_sector + volID->BPB_RsvdSecCnt + (volID->BPB_NumFATs * drive->fat_size);
 	drive->root_dir_entries					= volID->BPB_RootEntCnt;
 	drive->cluster_begin_sector				= drive->partition_begin_sector + volID->BPB_RsvdSecCnt + (volID->BPB_NumFATs * drive->fat_size) + RootDirSectors;
 
 	drive->cwd[0] = drive->idDrive;	drive->cwd[1] = L':';	drive->cwd[2] = L'/';	drive->cwd[3] = 0;
-	drive->last_fat_sector	 = 0xfffffff;		// we have nothing in the fatTable buffer
-	drive->fat_dirty		 = false;			// so it doesn't need writing
+	for(int i=0; i<N_FATBUFFERS; ++i){
+		drive->fatBuffers[i].fat_sector = 0xffffffff;	// we have nothing in the fat buffers
+		drive->fatBuffers[i].fat_dirty	= false;		// so they don't need writing
+		drive->fatBuffers[i].last_used	= 0;
+	}
+	drive->fatCurrent		 = &drive->fatBuffers[0];
+	drive->nFatDirty		 = 0;
+	drive->fat_clock		 = 0;
+	drive->fat_hits			 = 0;
+	drive->fat_misses		 = 0;
 	drive->fat_free_speedup	 = 0;				// and we have no idea yet where the spaces are
+	drive->next_free		 = 2;
+	drive->free_clusters	 = 0xffffffff;
+	drive->bad_clusters		 = 0xffffffff;
+	drive->fsinfo_sector	 = 0;
+	if(drive->fat_type==FAT32)
+		ReadFSInfo(drive, volID->BPB_FSInfo);		// free space hints
+#if YY_FAT12_RESIDENT
+	if(drive->fat_type==FAT12)
+		YY_LoadFat12(drive);
+#endif
+#if YY_FREEMAP
+	YY_BuildFreeMap(drive);						// unless we read the whole FAT now
+#endif
 
 	if(bVerbose){
 		const char* flist[] = { "0", "12", "16", "32" };
@@ -287,14 +405,98 @@ YY_DRIVE* YY_MountDrive(uint8_t idDevice)
 		printf("Total cluster for data: %u\n", drive->count_of_clusters);
 		printf("Sectors per Cluster:  %u  shift: %u  mask: 0x%02x\n", volID->BPB_SecPerClus, drive->sectors_to_cluster_right_slide, drive->sectors_in_cluster_mask);
 		printf("Reserved Sectors:  %u\n", volID->BPB_RsvdSecCnt);
-		printf("Number of FATS:  %d\n", volID->BPB_NumFATs);
+		printf("Number of FATS:  %d  written: %d\n", volID->BPB_NumFATs, drive->fat_copies);
 		printf("Root Directory first sector:  %u\n", drive->root_dir_first_sector);
 		printf("fat_begin_sector:  %" PRIu32 "\n", drive->fat_begin_sector);
 		printf("cluster_begin_sector:  %" PRIu32 "\n", drive->cluster_begin_sector);
 		printf("Root Directory first sector:  %u\n", drive->root_dir_first_sector);
 		printf("Root Directory entries:  %u\n", drive->root_dir_entries);
+		if(drive->free_clusters!=0xffffffff)
+			printf("Free clusters:  %u  next free: %u\n", drive->free_clusters, drive->next_free);
+		if(drive->bad_clusters!=0xffffffff && drive->bad_clusters!=0)
+			printf("Bad clusters:  %u\n", drive->bad_clusters);
 		uint8_t temp[MAX_PATH];
 		printf("CWD: %s\n\n", (char*)YY_ToNarrow(temp, sizeof temp, drive->cwd));
 	}
 	return drive;
-}
\ No newline at end of file
+}
+// the drive isn't anyone else's until it's all set up so all of it is under mountLock
+YY_DRIVE* YY_MountDrive(uint8_t idDevice)
+{
+	YY_Lock(&mountLock);
+	YY_DRIVE* drive = mountDrive(idDevice);
+	YY_Unlock(&mountLock);
+	return drive;
+}
+// which drive is a path on: "A:..." or the default, mounted if need be
+YY_DRIVE* YY_PathDrive(const uint16_t* path)
+{
+	uint8_t driveLetter = YY_defaultDrive;
+	if(path && path[0] && path[1]==L':')
+		driveLetter = (uint8_t)path[0];
+	return YY_MountDrive(driveLetter);
+}
+//-------------------------------------------------------------------------------------------------
+// Locks, readers of a drive share it and anything that changes it has it alone
+//-------------------------------------------------------------------------------------------------
+void YY_LockDrive(YY_DRIVE* drive, bool bShared)
+{
+	YY_Lock(&driveLocks[drive-yy_drives].drive, bShared);
+}
+void YY_UnlockDrive(YY_DRIVE* drive, bool bShared)
+{
+	YY_Unlock(&driveLocks[drive-yy_drives].drive, bShared);
+}
+void YY_LockFat(YY_DRIVE* drive)
+{
+	YY_Lock(&driveLocks[drive-yy_drives].fat);
+}
+void YY_UnlockFat(YY_DRIVE* drive)
+{
+	YY_Unlock(&driveLocks[drive-yy_drives].fat);
+}
+static void unmountDrive(YY_DRIVE* drive)
+{
+	YY_FlushFAT(drive);
+	YY_ForgetNames(drive);
+	YY_InvalidateCache(drive->hDevice);
+	if(drive->freeMap){
+		for(uint16_t i=0; i<drive->freeMapPages; ++i)
+			XX_free(drive->freeMap[i]);
+		XX_free(drive->freeMap);
+		drive->freeMap		= nullptr;
+		drive->freeMapPages = 0;
+	}
+	if(drive->fat12){
+		XX_free(drive->fat12);
+		drive->fat12		= nullptr;
+		drive->fat12Entries = 0;
+	}
+	XX_CloseDevice(drive->hDevice);
+	drive->hDevice = nullptr;
+	drive->idDrive = 0;
+}
+// Get everything onto the device and let go of it, the slot can be mounted again
+// it waits for anyone using the drive but it's up to you that nobody has anything open on it
+void YY_UnmountDrive(YY_DRIVE* drive)
+{
+	if(drive==nullptr) return;
+	YY_LockDrive(drive, false);
+	YY_Lock(&mountLock);
+	if(drive->idDrive!=0)
+		unmountDrive(drive);
+	YY_Unlock(&mountLock);
+	YY_UnlockDrive(drive, false);
+}
+#if _DEBUG
+// so we can size N_FATBUFFERS
+void FatCacheStats(uint8_t idDrive, uint32_t* hits, uint32_t* misses)
+{
+	*hits = *misses = 0;
+	for(int n=0; n<N_DRIVES; ++n)
+		if(yy_drives[n].idDrive==idDrive){
+			*hits	= yy_drives[n].fat_hits;
+			*misses	= yy_drives[n].fat_misses;
+		}
+}
+#endif
\ No newline at end of file
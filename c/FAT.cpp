@@ -37,7 +37,8 @@
 //
 //=================================================================================================
 // WARNING! This code has nestable compatibility in that you can work on two or more file at
-// once even in the sane device/folder but it does not have interruptible  reentrancy !!!!
+// once even in the sane device/folder. On the hosts the ZZ_ calls can also come from several
+// threads at once (see YY_THREADS) but it still does not have interruptible reentrancy !!!!
 //=================================================================================================
 
 #include <cstdio>
@@ -45,11 +46,13 @@
 #include <io.h>
 #include <fcntl.h>
 #include <cstdint>
+#include <cstring>
 #include <cassert>
 #include <inttypes.h>		// see: https://en.cppreference.com/w/cpp/types/integer for printf'ing silly things
 #include <windows.h>
 #include <vector>
 
+#include "FAT_OS.h"
 #include "FAT_XX.h"
 //#include "FAT_YY.h"
 #include "FAT_ZZ.h"
@@ -136,9 +139,11 @@ int getnum()
 
 //-------------------------------------------------------------------------------------------------
 // Open the target drive
+// XX_DIRECT is ignored as FILE_FLAG_NO_BUFFERING wants aligned buffers and we don't do those here
+// and so is XX_MAPPED as we are usually talking to a real device
 //-------------------------------------------------------------------------------------------------
 
-HANDLE XX_OpenDevice(const char* nameDevice)
+HANDLE XX_OpenDevice(const char* nameDevice, uint8_t flags)
 {
 	HANDLE hf = CreateFile(nameDevice , GENERIC_READ | GENERIC_WRITE,
 				FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, 0  /*FILE_FLAG_NO_BUFFERING*/, nullptr);
@@ -149,6 +154,40 @@ HANDLE XX_OpenDevice(const char* nameDevice)
 	}
 	return INVALID_HANDLE_VALUE;
 }
+void XX_CloseDevice(HANDLE hDevice)
+{
+	CloseHandle(hDevice);
+}
+//-------------------------------------------------------------------------------------------------
+// Make an image file nSectors long, sparse if the file system can do it
+//-------------------------------------------------------------------------------------------------
+bool XX_CreateImage(const char* name, uint32_t nSectors)
+{
+	HANDLE hf = CreateFile(name, GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if(hf==INVALID_HANDLE_VALUE) return false;
+	DWORD n;
+	DeviceIoControl(hf, FSCTL_SET_SPARSE, nullptr, 0, nullptr, 0, &n, nullptr);	// NTFS yes, FAT no, either is fine
+	LARGE_INTEGER cb;
+	cb.QuadPart = (LONGLONG)nSectors*512;
+	bool ok = SetFilePointerEx(hf, cb, nullptr, FILE_BEGIN) && SetEndOfFile(hf);
+	CloseHandle(hf);
+	return ok;
+}
+// how big is it? a disk says with an IOCTL and an image file is just a file
+uint32_t XX_DeviceSectors(HANDLE hDevice)
+{
+	GET_LENGTH_INFORMATION info;
+	DWORD n;
+	LARGE_INTEGER cb;
+	if(DeviceIoControl(hDevice, IOCTL_DISK_GET_LENGTH_INFO, nullptr, 0, &info, sizeof info, &n, nullptr))
+		cb = info.Length;
+	else if(!GetFileSizeEx(hDevice, &cb))
+		return 0;
+	return (uint64_t)cb.QuadPart/512 > 0xffffffff ? 0xffffffff : (uint32_t)(cb.QuadPart/512);
+}
+// the file pointer is the handle's so a seek and the transfer after it go together
+static XX_LOCK seekLock = XX_LOCK_INIT;
+
 //-------------------------------------------------------------------------------------------------
 // Read a sector from the device
 //-------------------------------------------------------------------------------------------------
@@ -163,13 +202,15 @@ bool XX_ReadSector(HANDLE hDevice, uint32_t sector, void* buffer)
 	} a;
 	a.c = (uint64_t)sector*512;	// byte address
 
-	if(SetFilePointer(hDevice, a.b[0], &a.b[1], FILE_BEGIN)==INVALID_SET_FILE_POINTER) return false;
+	XX_Lock(&seekLock);
 	DWORD nRead;
 	// ReadFile at HW level only works on sector size address boundaries and in sector size or multiples blocks
 	// for this application no worries.
 	// HOWEVER it only works in one of my card holders which is more perplexing...
-	bool ret = ReadFile(hDevice, buffer, 512, &nRead, nullptr)!=0	// return not zero on success
+	bool ret = SetFilePointer(hDevice, a.b[0], &a.b[1], FILE_BEGIN)!=INVALID_SET_FILE_POINTER
+		&& ReadFile(hDevice, buffer, 512, &nRead, nullptr)!=0	// return not zero on success
 		&& nRead == 512;
+	XX_Unlock(&seekLock);
 
 //	if(bVerbose) printf("\nRead Sector %lu OK\n", sector);
 	return ret;
@@ -185,15 +226,99 @@ bool XX_WriteSector(HANDLE hDevice, uint32_t sector, void* buffer)
 	} a;
 	a.c = (uint64_t)sector*512;	// byte address
 
-	if(SetFilePointer(hDevice, a.b[0], &a.b[1], FILE_BEGIN)==INVALID_SET_FILE_POINTER) return false;
+	XX_Lock(&seekLock);
 	DWORD nWrite;
-	bool ret = WriteFile(hDevice, buffer, 512, &nWrite, nullptr)!=0	// return not zero on success
+	bool ret = SetFilePointer(hDevice, a.b[0], &a.b[1], FILE_BEGIN)!=INVALID_SET_FILE_POINTER
+		&& WriteFile(hDevice, buffer, 512, &nWrite, nullptr)!=0	// return not zero on success
 		&& nWrite == 512;
+	XX_Unlock(&seekLock);
 
 //	if(bVerbose) printf("Write Sector %lu OK\n", sector);
 	return ret;
 }
 //-------------------------------------------------------------------------------------------------
+// Read/Write a run of consecutive sectors in one go
+//-------------------------------------------------------------------------------------------------
+bool XX_ReadSectors(HANDLE hDevice, uint32_t sector, uint16_t count, void* buffer)
+{
+	union {						// as above
+		LONG b[2];
+		uint64_t c;
+	} a;
+	a.c = (uint64_t)sector*512;	// byte address
+
+	XX_Lock(&seekLock);
+	DWORD nRead;
+	bool ret = SetFilePointer(hDevice, a.b[0], &a.b[1], FILE_BEGIN)!=INVALID_SET_FILE_POINTER
+		&& ReadFile(hDevice, buffer, count*512, &nRead, nullptr)!=0 && nRead == count*512;
+	XX_Unlock(&seekLock);
+	return ret;
+}
+bool XX_WriteSectors(HANDLE hDevice, uint32_t sector, uint16_t count, void* buffer)
+{
+	union {						// as above
+		LONG b[2];
+		uint64_t c;
+	} a;
+	a.c = (uint64_t)sector*512;	// byte address
+
+	XX_Lock(&seekLock);
+	DWORD nWrite;
+	bool ret = SetFilePointer(hDevice, a.b[0], &a.b[1], FILE_BEGIN)!=INVALID_SET_FILE_POINTER
+		&& WriteFile(hDevice, buffer, count*512, &nWrite, nullptr)!=0 && nWrite == count*512;
+	XX_Unlock(&seekLock);
+	return ret;
+}
+//-------------------------------------------------------------------------------------------------
+// Scatter/gather versions where each sector has its own buffer
+// ReadFileScatter() wants unbuffered handles and page sized buffers so I do it with one transfer
+// into a bounce buffer and copy the sectors out (or in)
+//-------------------------------------------------------------------------------------------------
+bool XX_ReadSectorsV(HANDLE hDevice, uint32_t sector, uint16_t count, void** buffers)
+{
+	if(count>XX_MAX_SECTORS) return false;
+	uint8_t* bounce = (uint8_t*)XX_alloc(count*512);
+	if(bounce==nullptr) return false;
+	bool ret = XX_ReadSectors(hDevice, sector, count, bounce);
+	if(ret)
+		for(uint16_t i=0; i<count; ++i)
+			memcpy(buffers[i], bounce+i*512, 512);
+	XX_free(bounce);
+	return ret;
+}
+bool XX_WriteSectorsV(HANDLE hDevice, uint32_t sector, uint16_t count, void** buffers)
+{
+	if(count>XX_MAX_SECTORS) return false;
+	uint8_t* bounce = (uint8_t*)XX_alloc(count*512);
+	if(bounce==nullptr) return false;
+	for(uint16_t i=0; i<count; ++i)
+		memcpy(bounce+i*512, buffers[i], 512);
+	bool ret = XX_WriteSectors(hDevice, sector, count, bounce);
+	XX_free(bounce);
+	return ret;
+}
+//-------------------------------------------------------------------------------------------------
+// Nothing is memory mapped here so there is never a sector to borrow and nothing to flush
+//-------------------------------------------------------------------------------------------------
+uint8_t* XX_MapSector(HANDLE hDevice, uint32_t sector)
+{
+	return nullptr;
+}
+bool XX_FlushDevice(HANDLE hDevice)
+{
+	return true;
+}
+//-------------------------------------------------------------------------------------------------
+// The time now packed as a directory entry wants it
+//-------------------------------------------------------------------------------------------------
+void XX_GetDateTime(uint16_t* date, uint16_t* time)
+{
+	SYSTEMTIME st;
+	GetLocalTime(&st);
+	*date = ((st.wYear-1980)<<9) | (st.wMonth<<5) | st.wDay;
+	*time = (st.wHour<<11) | (st.wMinute<<5) | (st.wSecond/2);
+}
+//-------------------------------------------------------------------------------------------------
 // Memory management functions
 //-------------------------------------------------------------------------------------------------
 void* XX_alloc(uint16_t nbytes)
@@ -205,12 +330,74 @@ void XX_free(void* item)
 	delete[] (BYTE*)item;
 }
 //-------------------------------------------------------------------------------------------------
+// Locks, slim reader/writer locks as they need no setting up and cost nothing if nobody waits
+//-------------------------------------------------------------------------------------------------
+void XX_Lock(XX_LOCK* lock, bool bShared)
+{
+	if(bShared) AcquireSRWLockShared(lock);
+	else		AcquireSRWLockExclusive(lock);
+}
+void XX_Unlock(XX_LOCK* lock, bool bShared)
+{
+	if(bShared) ReleaseSRWLockShared(lock);
+	else		ReleaseSRWLockExclusive(lock);
+}
+void XX_Yield()
+{
+	SwitchToThread();
+}
+//-------------------------------------------------------------------------------------------------
+// Threads: work(args[0]) runs on the caller and the rest get a thread each. Any that can't have
+// one run on the caller too so they all get done whatever. Returns when they have all finished.
+//-------------------------------------------------------------------------------------------------
+uint16_t XX_Cores()
+{
+	SYSTEM_INFO si;
+	GetSystemInfo(&si);
+	return si.dwNumberOfProcessors ? (uint16_t)si.dwNumberOfProcessors : 1;
+}
+#pragma pack(push, 8)
+struct XX_THREAD { HANDLE hThread; void (*work)(void*); void* arg; };
+#pragma pack(pop)
+static DWORD WINAPI threadStart(LPVOID p)
+{
+	XX_THREAD* t = (XX_THREAD*)p;
+	t->work(t->arg);
+	return 0;
+}
+void XX_RunThreads(void (*work)(void* arg), void** args, uint16_t n)
+{
+	XX_THREAD* threads = n>1 ? (XX_THREAD*)XX_alloc((uint16_t)(n*sizeof(XX_THREAD))) : nullptr;
+	for(uint16_t i=1; threads && i<n; ++i){
+		threads[i].work	   = work;
+		threads[i].arg	   = args[i];
+		threads[i].hThread = CreateThread(nullptr, 0, threadStart, &threads[i], 0, nullptr);
+	}
+	if(n) work(args[0]);
+	for(uint16_t i=1; i<n; ++i)
+		if(threads && threads[i].hThread){
+			WaitForSingleObject(threads[i].hThread, INFINITE);
+			CloseHandle(threads[i].hThread);
+		}
+		else
+			work(args[i]);
+	if(threads) XX_free(threads);
+}
+//-------------------------------------------------------------------------------------------------
 // main
 //-------------------------------------------------------------------------------------------------
 
 void head(){
-	printf(" File Slots: %d/100    Directory slots: %d/20  ZZ slots: %d/100\n",
+	printf(" File Slots: %d    Directory slots: %d  ZZ slots: %d\n",
 		UsedFileSlots(), UsedDirectorySlots(), UsedZZthings());
+	uint32_t hitsA, missesA, hitsC, missesC;
+	FatCacheStats('A', &hitsA, &missesA);
+	FatCacheStats('C', &hitsC, &missesC);
+	printf(" FAT cache A: %u hits %u misses    C: %u hits %u misses\n", hitsA, missesA, hitsC, missesC);
+	CacheStats(&hitsA, &missesA);
+	printf(" Sector cache: %u hits %u misses\n", hitsA, missesA);
+	NameCacheStats(&hitsA, &missesA);
+	printf(" Name cache: %u hits %u misses\n", hitsA, missesA);
 }
 void skip_preamble(ZZ_FILE* fp)
 {
@@ -223,11 +410,82 @@ void skip_preamble(ZZ_FILE* fp)
 			ZZ_fseek(fp, 0, 0);
 	}
 }
-int main()
+//-------------------------------------------------------------------------------------------------
+// FAT walk [-c] [-v] [-j threads] path
+// An inventory of the tree from path: a line per folder with its files, folders, bytes and, with
+// -c, a CRC32 over the CRC32s of its files. -v lists every item too. Progress goes to stderr.
+// It uses a thread per core unless -j says otherwise so the folders come out in no fixed order.
+//-------------------------------------------------------------------------------------------------
+struct WALKSTATS {
+	uint32_t	files, folders, errors;
+	uint64_t	bytes;
+	ULONGLONG	start, lastReport;
+	bool		bItems;
+};
+static void walkProgress(WALKSTATS* s, ULONGLONG now)
+{
+	ULONGLONG ms = now - s->start;
+	fprintf(stderr, "%u items %" PRIu64 " bytes %.0f items/s\r", s->files+s->folders, s->bytes,
+			ms ? (s->files+s->folders)*1000.0/ms : 0.0);
+}
+static bool walkItem(const uint8_t* path, ZZ_DIRENT* e, uint32_t crc, void* user)
+{
+	WALKSTATS* s = (WALKSTATS*)user;
+	if(s->bItems)
+		printf("  %10u  %08X  %s%s%s\n", e->size, crc, path, e->name, (e->attr & 0x10) ? "/" : "");	// 0x10 is a folder
+	return true;
+}
+static bool walkFolder(ZZ_WALKFOLDER* f, void* user)
+{
+	WALKSTATS* s = (WALKSTATS*)user;
+	s->files   += f->files;
+	s->folders += f->folders;
+	s->bytes   += f->bytes;
+	s->errors  += f->errors;
+	printf("%6u %6u %12" PRIu64 "  %08X  %s%s\n", f->files, f->folders, f->bytes, f->checksum, f->path,
+			f->errors ? "  (errors)" : "");
+	ULONGLONG now = GetTickCount64();
+	if(now - s->lastReport >= 1000){
+		s->lastReport = now;
+		walkProgress(s, now);
+	}
+	return true;
+}
+static int walk(int argc, char* argv[])
+{
+	uint8_t flags = ZZ_NODOTS;
+	WALKSTATS s{};
+	const char* path = nullptr;
+	uint16_t nThreads = 0;
+	for(int i=0; i<argc; ++i)
+		if(strcmp(argv[i], "-c")==0)					flags |= ZZ_CHECKSUM;
+		else if(strcmp(argv[i], "-v")==0)				s.bItems = true;
+		else if(strcmp(argv[i], "-j")==0 && i+1<argc)	nThreads = (uint16_t)atoi(argv[++i]);
+		else											path = argv[i];
+	if(path==nullptr){
+		printf("FAT walk [-c] [-v] [-j threads] path\n");
+		return -1;
+	}
+	printf(" Files Folders        Bytes     CRC32  Folder\n");
+	s.start = s.lastReport = GetTickCount64();
+	bool ok = ZZ_walk((U8)path, flags, walkItem, walkFolder, &s, nThreads);
+	walkProgress(&s, GetTickCount64());
+	fprintf(stderr, "\n");
+	printf("%u files in %u folders, %" PRIu64 " bytes, %u errors%s\n", s.files, s.folders, s.bytes, s.errors,
+			ok ? "" : " (stopped)");
+	return ok && s.errors==0 ? 0 : 1;
+}
+int mkfat(int argc, char* argv[]);		// mkfat.cpp
+int main(int argc, char* argv[])
 {
 	SetConsoleOutputCP(CP_UTF8);				// with these set we can print utf8
 //	setvbuf(stdout, nullptr, _IOFBF, 1000);		// but %ls still won't do wchar_t >0xff
 
+	if(argc>1 && strcmp(argv[1], "walk")==0)
+		return walk(argc-2, argv+2);
+	if(argc>1 && strcmp(argv[1], "mkfat")==0)
+		return mkfat(argc-2, argv+2);
+
     printf("FAT reader\n==========\n");
 	system("wmic diskdrive list brief");			// list things so we know what "PhysicalDevice2" really is
 
@@ -274,6 +532,8 @@ int main()
 	ZZ_FOLDER *fa{};
 	ZZ_FOLDER *fb{};
 	std::vector<ZZ_FILE*> folder{};
+	uint8_t name[3*MAX_PATH], path[3*MAX_PATH];		// utf8 can be three bytes a character
+	char desc[3*MAX_PATH];
 
 root:
 	if(fa) ZZ_closefolder(fa);
@@ -292,21 +552,21 @@ again:
 	folder.clear();
 	head();
 
-	printf("\nDirectory of %s\n", (char*)ZZ_folderpathname(fa));
+	printf("\nDirectory of %s\n", (char*)ZZ_folderpathname(fa, path, sizeof path));
 	printf("    Date         Time      Attr       Size  Start Sect   Name\n");
 	ZZ_FILE* file;
 	uint16_t item = 1;
 	while((file = ZZ_findnextfile(fa))!=nullptr){
-		printf("%3d %s\n", item++, ZZ_writefiledesc(file));
+		printf("%3d %s\n", item++, ZZ_writefiledesc(file, desc, sizeof desc));
 		folder.push_back(file);
 	}
 	fflush(stdout);
 
 	uint16_t itemX = item-1;
-	printf("\nDirectory of %s\n", (char*)ZZ_folderpathname(fb));
+	printf("\nDirectory of %s\n", (char*)ZZ_folderpathname(fb, path, sizeof path));
 	printf("    Date         Time      Attr       Size  Start Sect   Name\n");
 	while((file = ZZ_findnextfile(fb))!=nullptr){
-		printf("%3d %s\n", item++, ZZ_writefiledesc(file));
+		printf("%3d %s\n", item++, ZZ_writefiledesc(file, desc, sizeof desc));
 		folder.push_back(file);
 	}
 	fflush(stdout);
@@ -328,12 +588,12 @@ again:
 	file = folder[item];
 
 	if(ZZ_isDIR(file)){
-		if(item<itemX)	ZZ_changefolder(fa, ZZ_longname(file));
-		else			ZZ_changefolder(fb, ZZ_longname(file));
+		if(item<itemX)	ZZ_changefolder(fa, ZZ_longname(file, name, sizeof name));
+		else			ZZ_changefolder(fb, ZZ_longname(file, name, sizeof name));
 	}
 	else if(ZZ_isFILE(file)){
 		printf("===========================================================================================================\n"
-			  "listing file %s%s\n", ZZ_longpath(file), ZZ_longname(file));
+			  "listing file %s%s\n", ZZ_longpath(file, path, sizeof path), ZZ_longname(file, name, sizeof name));
 
 		ZZ_FILE* fp = ZZ_fopenD(file, (U8)"r");	// open file to read
 		if(fp==nullptr)
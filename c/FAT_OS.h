@@ -0,0 +1,28 @@
+#pragma once
+//-------------------------------------------------------------------------------------------------
+// The FAT library is developed on Windows but it also has to build on POSIX systems so this is
+// <windows.h> there and just the few bits of it we use everywhere else.
+//-------------------------------------------------------------------------------------------------
+
+#if defined(_WIN32)
+#include <windows.h>
+#include <intrin.h>
+
+typedef SRWLOCK			XX_LOCK;				// reader/writer lock for XX_Lock()
+#define XX_LOCK_INIT	SRWLOCK_INIT
+#else
+#include <cstring>
+#include <cctype>
+#include <cstdlib>
+#include <pthread.h>
+
+typedef pthread_rwlock_t XX_LOCK;
+#define XX_LOCK_INIT	PTHREAD_RWLOCK_INITIALIZER
+
+typedef void*	HANDLE;
+typedef void*	LPVOID;
+#define INVALID_HANDLE_VALUE	((HANDLE)(intptr_t)-1)
+#define MAX_PATH				260
+#define _countof(a)				(sizeof(a)/sizeof((a)[0]))
+#define sprintf_s				snprintf
+#endif
@@ -9,10 +9,29 @@ void	error();							// windows error codes to readable text
 void	dump(void* buffer, int cb=512);		// dump in familiar bytes/chars blocks
 extern bool bVerbose;						// turn on process messages
 
-// routines in FAT.cpp that need to be coded in Z80 speak
-HANDLE	XX_OpenDevice(const char* what_to_open);						// hardware Open
+#define XX_MAX_SECTORS	64					// most sectors in one XX_ multi-sector transfer (32K)
+#define XX_DIRECT		0x01				// XX_OpenDevice() flag: bypass the host's cache if it can
+#define XX_MAPPED		0x02				// XX_OpenDevice() flag: memory map an image so sectors can be borrowed
+
+// routines in FAT.cpp (or Posix_XX.cpp) that need to be coded in Z80 speak
+HANDLE	XX_OpenDevice(const char* what_to_open, uint8_t flags=0);		// hardware Open
+void	XX_CloseDevice(HANDLE hDevice);									// and close
+bool	XX_CreateImage(const char* name, uint32_t nSectors);			// a new (sparse) image file to open
+uint32_t XX_DeviceSectors(HANDLE hDevice);								// how big an open device is
 bool	XX_ReadSector(HANDLE hDevice, uint32_t sector, void* buffer);	// hardware Read
 bool	XX_WriteSector(HANDLE hDevice, uint32_t sector, void* buffer);	// hardware write
+bool	XX_ReadSectors(HANDLE hDevice, uint32_t sector, uint16_t count, void* buffer);		// consecutive sectors
+bool	XX_WriteSectors(HANDLE hDevice, uint32_t sector, uint16_t count, void* buffer);
+bool	XX_ReadSectorsV(HANDLE hDevice, uint32_t sector, uint16_t count, void** buffers);	// scatter
+bool	XX_WriteSectorsV(HANDLE hDevice, uint32_t sector, uint16_t count, void** buffers);	// gather
+uint8_t* XX_MapSector(HANDLE hDevice, uint32_t sector);				// sector in memory if mapped or nullptr
+bool	XX_FlushDevice(HANDLE hDevice);									// get mapped writes onto the device
+void	XX_GetDateTime(uint16_t* date, uint16_t* time);					// now, in FAT directory format
 void*	XX_alloc(uint16_t nBytes);										// allocator
 void	XX_free(void* item);											// de-allocator
+void	XX_Lock(XX_LOCK* lock, bool bShared=false);						// shared holders only keep out exclusive ones
+void	XX_Unlock(XX_LOCK* lock, bool bShared=false);
+void	XX_Yield();														// let another thread have the CPU
+uint16_t XX_Cores();													// how many threads are worth running at once
+void	XX_RunThreads(void (*work)(void* arg), void** args, uint16_t n);	// work(args[i]) on n threads and wait
 
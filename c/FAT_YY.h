@@ -11,11 +11,198 @@ public:
 	void		set(uint32_t v)	{ a[0] = v&0xff; a[1] = (v>>8)&0xff; a[2] = (v>>16)&0xff; }
 };
 
+//=================================================================================================
+// What is on the disk: the partition table in sector 0 (unless it's a floppy) and the first
+// sector of a FAT volume. Drives_YY.cpp reads them and Format_YY.cpp writes them.
+//=================================================================================================
+struct BOOT_SECTOR {
+	uint8_t jmp[3];
+	uint8_t test[8];					// if this says "MSDOS5.0" think floppy with no partition table
+	uint8_t	fill[435];					// this is where the 'boot' code goes
+	struct PARTITION {					// partition table
+			uint8_t		BootFlag;
+			uint24_t	CHS_Begin;
+			uint8_t		Type_Code;
+			uint24_t	CHS_End;
+			uint32_t	LBA_Begin;
+			uint32_t	nSectors;
+	} Partitions[4];
+	uint8_t sig1;
+	uint8_t sig2;
+};
+
+// I experimented with more readable names but it makes it a lot easier to read the Microsoft documentation keeping their mangled 14 character names
+struct FAT_VOL_ID {
+	uint8_t		BS_jmpBoot[3];					// 0
+	uint8_t		BS_OEMName[8];					// 3
+	uint16_t	BPB_BytsPerSec;					// 11 Bytes per Sector, normally 512 but could be 512,1024,2048, 4096
+	uint8_t		BPB_SecPerClus;					// 13 Sectors per Cluster, always a power of two (1,2,4...128)
+	uint16_t	BPB_RsvdSecCnt;					// 14 Number of Reserved Sectors, if none needed is used to pad the data area start to a cluster
+	uint8_t		BPB_NumFATs;					// 16 Number of FATs, always 2 although 1 is officially allowed
+	uint16_t	BPB_RootEntCnt;					// 17 number of entries in root dir, FAT12/16 only with fixed root directory
+	uint16_t	BPB_TotSec16;					// 19 total sectors, FAT12/16 only
+	uint8_t		BPB_Media;						// 21 Media type
+	uint16_t	BPB_FATSz16;					// 22 SectorPer FAT 12/16
+	uint16_t	BPB_SecPerTrk;					// 24 Sectors Per Track, only relevant to devices that care
+	uint16_t	BPB_NumHeads;					// 26 Number of heads, ditto
+	uint32_t	BPB_HiddSec;					// 28 zero
+	uint32_t	BPB_TotSec32;					// 32 number of sectors, FAT32 only
+	union{
+		// FAT12/16 version
+		struct{
+			uint8_t		BS_DrvNum;				// 36
+			uint8_t		BS_Reserved1;			// 37
+			uint8_t		BS_BootSig;				// 38
+			uint32_t	BS_VolID;				// 39
+			uint8_t		BS_VolLab[11];			// 43
+			uint8_t		BS_FilSysType[8];		// 54
+			uint8_t		fill1[448];				// 62
+		};
+		// FAT32 version
+		struct{
+			uint32_t	BPB_FATSz32;			// 36 Sectors Per FAT
+			uint16_t	BPB_ExtFlags;			// 40
+			uint16_t	BPB_FSVer;				// 42 must be zero
+			uint32_t	BPB_RootClus;			// 44 Root Directory First Cluster
+			uint16_t	BPB_FSInfo;				// 48
+			uint16_t	BPB_BkBootSec;			// 50 0 or 6
+			uint8_t		BPB_Reserved[12];		// 52 zeros
+			uint8_t		BS_DrvNum32;			// 64 (name not Microsoft due to duplication in FAT12/16)
+			uint8_t		BS_Reserved1_32;		// 65 (ditto)
+			uint8_t		BS_BootSig32;			// 66 (ditto)
+			uint32_t	BS_VolID32;				// 67 (ditto)
+			uint8_t		BS_VolLab32[11];		// 71 (ditto)
+			uint8_t		BS_FilSysType32[8];		// 82 (ditto)
+			uint8_t		fill2[420];				// 90
+		};
+	};
+	uint8_t		sig1;							// 510 0x55
+	uint8_t		sig2;							// 511 0xaa
+};
+
+// FAT32 keeps a note of the free space in the FSInfo sector so we needn't count it
+struct FAT_FSINFO {
+	uint32_t	FSI_LeadSig;					// 0 0x41615252
+	uint8_t		FSI_Reserved1[480];				// 4
+	uint32_t	FSI_StrucSig;					// 484 0x61417272
+	uint32_t	FSI_Free_Count;					// 488 free clusters, 0xffffffff if unknown
+	uint32_t	FSI_Nxt_Free;					// 492 where to start looking for a free cluster, 0xffffffff if unknown
+	uint8_t		FSI_Reserved2[12];				// 496
+	uint32_t	FSI_TrailSig;					// 508 0xaa550000
+};
+
+//=================================================================================================
+// The sector cache in Cache_YY.cpp that all the reads and writes go through
+//=================================================================================================
+#ifndef N_CACHE_BLOCKS
+#define N_CACHE_BLOCKS	32				// memory budget in 512 byte sectors
+#endif
+#define N_CACHE_HASH	(N_CACHE_BLOCKS/2+1)	// hash chains to find them
+
+// Files and directories being read in order fetch ahead of themselves in runs that start at two
+// sectors and double each time they are used up until they reach this
+#ifndef YY_READAHEAD_MAX
+#define YY_READAHEAD_MAX	(N_CACHE_BLOCKS/4)	// YY_PrefetchSectors() won't do more anyway
+#endif
+
 //=================================================================================================
 // Global things we read/deduce when we open a partition.
 // Once we have these we can loose the boot sector and the volume ID
 //=================================================================================================
 enum { UNKNOWN_FAT, FAT12, FAT16, FAT32 };
+
+// The FAT sectors are held in a small cache of buffers per drive with the least recently used one
+// being recycled. Chain walks and allocation scans that cross sector boundaries (and FAT12 entries
+// that straddle them) then stop thrashing the device. Size it with the hit/miss counters.
+#ifndef N_FATBUFFERS
+#define N_FATBUFFERS	4				// FAT sectors cached per drive
+#endif
+// FAT sectors that have changed wait in a sorted list until a sync, close or unmount (or the list
+// fills) and then go out to every copy of the FAT in runs
+#ifndef N_FATDIRTY
+#define N_FATDIRTY		64
+#endif
+#define FATFLUSH_RUN	8				// FAT sectors per write when flushing them
+
+// A FAT12 FAT is only a few sectors so keep the whole thing decoded in memory as an array of
+// entries. No 12 bit juggling, no FAT sector reads after mount and it is packed again on flush.
+#ifndef YY_FAT12_RESIDENT
+#define YY_FAT12_RESIDENT	1
+#endif
+
+// Optionally keep a bitmap of the free clusters in memory built at mount to make allocation fast
+#ifndef YY_FREEMAP
+#define YY_FREEMAP		1				// build the free cluster bitmap
+#endif
+#define FREEMAP_PAGE_WORDS	2048		// 8K bytes per page of bitmap (65536 clusters)
+#define FREEMAP_READ		16			// FAT sectors per read when building it
+
+// Use SSE2/AVX2 (if the compiler is targeting them) to scan FAT sectors 32 entries at a time
+#ifndef YY_SIMD
+#define YY_SIMD			1
+#endif
+
+// Let the ZZ_ calls come from several threads. Each drive has a reader/writer lock that the ZZ_
+// calls hold for their duration, shared if they only read and exclusive if they change anything,
+// and the things the drives share (sector cache, name cache, pools) have short locks of their own.
+// A YY_ caller holds the drive lock itself. Off (as it will be on the Z80) it all compiles away.
+#ifndef YY_THREADS
+#define YY_THREADS		1
+#endif
+#if YY_THREADS
+inline void YY_Lock(XX_LOCK* lock, bool bShared=false)		{ XX_Lock(lock, bShared); }
+inline void YY_Unlock(XX_LOCK* lock, bool bShared=false)	{ XX_Unlock(lock, bShared); }
+#else
+inline void YY_Lock(XX_LOCK*, bool=false)					{}
+inline void YY_Unlock(XX_LOCK*, bool=false)					{}
+#endif
+
+// Files being written reserve clusters in contiguous runs, starting at YY_ALLOC_BATCH and doubling
+// each time they grow up to YY_ALLOC_MAX, and what isn't used goes back on close
+#ifndef YY_ALLOC_BATCH
+#define YY_ALLOC_BATCH		8
+#endif
+#ifndef YY_ALLOC_MAX
+#define YY_ALLOC_MAX		1024
+#endif
+
+// Open files, directories and ZZ_ handles come from pools in Pool_YY.cpp that grow an arena of
+// items at a time as needed up to YY_POOL_ARENAS arenas
+#ifndef YY_POOL_ARENAS
+#define YY_POOL_ARENAS		32
+#endif
+#ifndef YY_FILES_PER_ARENA
+#define YY_FILES_PER_ARENA	128				// so 4096 items, about 12K an arena
+#endif
+#ifndef YY_OPEN_PER_ARENA
+#define YY_OPEN_PER_ARENA	16				// of those 512 open at once
+#endif
+#ifndef YY_DIR_WINDOW
+#define YY_DIR_WINDOW		16				// sectors YY_ReadDirectory() reads in one go (8K)
+#endif
+#ifndef YY_DIRS_PER_ARENA
+#define YY_DIRS_PER_ARENA	8				// 256 directories
+#endif
+
+struct YY_FATBUFFER {
+	uint8_t		fatPrefix{};							// used to speed up FAT12 must be the byte before the table
+	uint8_t		fatTable[512]{};						// sector of fat information
+	uint8_t		fatSuffix{};							// only there to get overwritten
+	uint32_t	fat_sector{0xffffffff};					// FAT sector in this buffer
+	uint8_t		fat_dirty{};							// needs to be written
+	uint32_t	last_used{};							// LRU stamp from fat_clock
+};
+
+// The routines for one FAT type, see YY_SetFatOps()
+struct YY_DRIVE;
+struct YY_FATOPS {
+	uint32_t	(*get)(YY_DRIVE* drive, uint32_t cluster);					// read an entry
+	uint32_t	(*set)(YY_DRIVE* drive, uint32_t cluster, uint32_t value);	// write one, returns the old value
+	uint32_t	(*run)(YY_DRIVE* drive, uint32_t cluster, uint32_t max);	// links straight to the next cluster
+	uint32_t	bad;									// entries from here up are bad or end of chain
+	uint32_t	eoc;									// end of chain marker
+};
+
 struct YY_DRIVE {
 	HANDLE		hDevice{};								// link to the device
 	uint8_t		idDrive{};								// zero or the character ie: 'A' in "A:/"
@@ -27,18 +214,31 @@ struct YY_DRIVE {
 	uint32_t	fat_size{};								// how many sectors in a FAT
 	uint8_t		sectors_to_cluster_right_slide{};		// convert sectors to clusters by slide not multiply
 	uint8_t		sectors_in_cluster_mask{};				// remainder of sector%sectors_per_cluster
-	uint32_t	fat_begin_sector{};						// first sector of first FAT
+	uint32_t	fat_begin_sector{};						// first sector of first FAT (or the active one if not mirrored)
+	uint8_t		fat_copies{};							// FATs we write to, 1 if FAT32 mirroring is off
 	uint32_t	root_dir_first_sector{};				// first sector of root directory
 	uint16_t	root_dir_entries{};						// number of entries in root directory, zero for FAT32
 	uint32_t	cluster_begin_sector{};					// first sector of data area
 	uint32_t	count_of_clusters;						// number of data clusters
 	// fat management storage
-	uint8_t		fatPrefix{};							// used to speed up FAT12 must be the bytes before the table
-	uint8_t		fatTable[512]{};						// sector of fat information
-	uint8_t		fatSuffix{};							// only there to get overwritten
-	uint32_t	last_fat_sector{0xffffffff};			// FAT sector currently in buffer
-	uint8_t		fat_dirty{};							// needs to be written
-	uint32_t	fat_free_speedup{};						// cluster where we last found free space
+	const YY_FATOPS* fatOps{};							// the routines for our FAT type
+	YY_FATBUFFER	fatBuffers[N_FATBUFFERS]{};			// cached sectors of fat information
+	YY_FATBUFFER*	fatCurrent{};						// buffer returned by the last GetFatSector()
+	uint16_t*	fat12{};								// the whole FAT12 unpacked if YY_FAT12_RESIDENT
+	uint16_t	fat12Entries{};
+	uint32_t	fatDirty[N_FATDIRTY]{};					// FAT sectors changed since the last flush, sorted
+	uint16_t	nFatDirty{};
+	uint32_t	fat_clock{};							// ticks on every access to age the buffers
+	uint32_t	fat_hits{};								// cache statistics
+	uint32_t	fat_misses{};
+	uint32_t	fat_free_speedup{};						// FAT sector where we last found free space
+	uint32_t	next_free{};							// cluster to start looking for free space
+	uint32_t	free_clusters{0xffffffff};				// number of free clusters if known
+	uint32_t	bad_clusters{0xffffffff};				// and bad ones
+	uint16_t	dirWrites{};							// bumped for every directory sector we change
+	uint32_t	fsinfo_sector{};						// FAT32 FSInfo sector, zero if none
+	uint32_t**	freeMap{};								// pages of the free cluster bitmap, nullptr if none
+	uint16_t	freeMapPages{};
 };
 
 // there are 4 types of directory entry
@@ -63,35 +263,114 @@ struct YY_DIRSECT {						// a sector of directory can hold 16 entries
 	YY_DIRN entry[16];
 };
 
+// what YY_ReadDirectory() gives back for each item
+struct YY_DIRENTRY {
+	YY_DIRN			dirn;					// the short entry: attributes, dates, size and start cluster
+	uint16_t*		name;					// in the name buffer you gave YY_ReadDirectory(), cut short if it alone is too big
+	uint32_t		dirSector;				// where the item's first entry is
+	uint8_t			dirSlot;
+};
+// YY_ReadDirectory() flags
+#define RDF_SHORTNAMES	0x01		// don't put the long names together, just use the 8.3 ones
+#define RDF_NOHIDDEN	0x02		// leave out hidden and system items
+#define RDF_NODOTS		0x04		// leave out "." and ".."
+
+// a directory's path shared by all the items we found in it so each doesn't carry a copy
+struct YY_PATH {
+	uint16_t		refs;					// items (and the directory) using it
+	uint16_t		text[1];				// actually as long as it needs to be
+};
+
 // This is the directory item
 struct YY_DIRECTORY {
 	YY_DRIVE*		drive{};				// the drive (ie: partition)
 	uint32_t		startCluster{};
 	uint32_t		sector{};				// the sector we are working through
-	uint32_t		sectorinbuffer{0xffffffff};
-	YY_DIRSECT		buffer{};				// where we read our directory sectors too
+	uint32_t		sectorinbuffer{0xffffffff};	// the sector we loaded last
+	YY_DIRSECT*		buffer{};				// our directory sector, only pinned in the cache during a call
 	uint8_t			slot{};					// next DIRN[] slot
+	uint8_t			readAhead{};			// sectors to prefetch at the next cluster, 0 until we go sequential
+	bool			bEnd{};					// YY_NextDirectoryItem() ran out of items rather than failing
 	uint16_t		longPath[MAX_PATH]{};	// name of our folder
+	YY_PATH*		path{};					// longPath as handed out to items, made when first needed
+	uint16_t		itemName[MAX_PATH]{};	// the long name of the item being read is put together here
+	uint8_t			checksum{};				// of the short name the long name parts belong to
+	YY_DIRSECT*		window{};				// YY_ReadDirectory()'s run of sectors, XX_alloc()ed when first used
+	uint32_t		windowSector{};			// the first of them
+	uint16_t		windowCount{};			// how many
+	uint16_t		windowStamp{};			// drive->dirWrites when we read them
 };
 
-// a file/folder item
-struct YY_FILE {
-	YY_DRIVE		*drive{};				// 0 is free, our drive for cluster maths
-	YY_DIRN			dirn{};					// copy of our directory entry
-	uint32_t		startCluster{};			// first cluster on disk
-	uint16_t		longName[MAX_PATH]{};	// long (real) filename
-	uint16_t		pathName[MAX_PATH]{};	// where we live
-	uint8_t			shortnamechecksum{};	// used to read longName
-	// working buffer
+// what YY_Walk() tells you about each folder when it has read it all
+struct YY_WALKFOLDER {
+	const uint16_t*	path;					// where we are, "A:/folder/"
+	uint16_t		depth;					// 0 for the one we started at
+	uint32_t		files;					// in it, not below it
+	uint32_t		folders;
+	uint64_t		bytes;
+	uint32_t		checksum;				// CRC32 of its files' CRC32s in directory order
+	uint32_t		errors;					// files we couldn't read all of, 1 and nothing else if it wouldn't open
+};
+typedef bool (*YY_WALKITEM)(YY_DIRECTORY* dir, YY_DIRENTRY* entry, uint32_t crc, void* user);	// false to stop
+typedef bool (*YY_WALKDONE)(YY_WALKFOLDER* folder, void* user);
+#define WALK_CHECKSUM	0x80		// YY_Walk() flag to read every file for its CRC32, the rest are RDF_
+
+// what YY_Format() is to make, the zeros are "choose for me" and it fills in what it chose
+struct YY_FORMAT {
+	uint32_t		nSectors;				// size of the volume
+	uint8_t			fatType;				// FAT12/16/32 or UNKNOWN_FAT to go by the size
+	uint8_t			secPerClus;				// a power of two up to 128
+	uint8_t			nFats;					// copies of the FAT, 2 if 0
+	uint16_t		rootEntries;			// FAT12/16 root directory, 224 on a floppy and 512 otherwise
+	uint32_t		volID;					// serial number, 0 makes one from the date and time
+	char			label[12];				// volume label, "" for none
+	uint8_t			flags;					// FMT_
+	uint32_t		nClusters;				// what we got
+	uint32_t		fatSize;				// sectors in each FAT
+	uint32_t		dataSector;				// first sector of cluster 2 (from the start of the volume)
+};
+#define FMT_ZEROED		0x01		// the device reads as zeros already (a new sparse image) so don't write zeros
+
+// a run of contiguous clusters in a file
+struct YY_EXTENT {
+	uint32_t		fileCluster;			// cluster number in the file (0 is the first)
+	uint32_t		diskCluster;			// where that is on the disk
+	uint32_t		length;					// number of clusters in the run
+};
+
+// what an open file needs on top of its YY_FILE, only there while it's open
+struct YY_FILEIO {
 	uint32_t		sector_in_buffer_abs{};	// first sector of data on disk
 	uint32_t		sector_in_buffer_file{};// first sector of data in file
-	uint32_t		first_sector{};			// first sector of first cluster
-	uint32_t		first_sector_file{};	// speed up
-	uint8_t			buffer[512]{};			// current work in progress sector
+	YY_EXTENT*		extents{};				// map of the cluster chain built as we need it
+	uint16_t		nExtents{};				// runs in use
+	uint16_t		maxExtents{};			// runs allocated
+	uint16_t		lastExtent{};			// the run we found last time
+	uint8_t			extentsDone{};			// we have mapped to the end of the chain
+	uint8_t			buffer[512]{};			// our copy of the sector we are working in, see readsector()
+	uint8_t			readAhead{};			// read-ahead window in sectors, 0 until we go sequential
+	uint32_t		readAheadEnd{};			// first sector in file past what we prefetched
 	uint32_t		filePointer{};			// full file pointer
+	uint32_t		reserve{};				// clusters to ask for next time the file grows
 	uint8_t			file_dirty{};			// buffer needs a flush before reuse
+};
+
+// a file/folder item
+// Walking a directory makes one of these for every item so it is kept small: the names are
+// XX_alloc()ed to fit and the YY_FILEIO only comes when it's opened.
+struct YY_FILE {
+	YY_DRIVE		*drive{};				// our drive for cluster maths
+	YY_DIRN			dirn{};					// copy of our directory entry
+	uint32_t		startCluster{};			// first cluster on disk
+	uint16_t*		longName{};				// long (real) filename
+	YY_PATH*		path{};					// where we live
+	uint32_t		dirSector{};			// where our first directory entry (long name or short) is
+	uint8_t			dirSlot{};
+	uint32_t		entrySector{};			// and where the short entry is
+	uint8_t			entrySlot{};
 	// file functions stuff
 	uint8_t			open_mode{};			// b0=open, b1=read, b2=write
+	YY_FILEIO*		io{};					// nullptr until it's opened
 };
 // DIR_Attr bits
 #define ATTR_RO		0x01
@@ -119,17 +398,65 @@ struct YY_FILE {
 //  Subroutines
 //=================================================================================================
 
-// Routine in Drive_YY.cpp
+// a pool of fixed sized items with a free list threaded through the unused ones
+struct YY_POOL {
+	uint16_t		size;					// bytes in an item, rounded up to a whole number of pointers
+	uint16_t		perArena;				// items in each arena
+	uint8_t			nArenas{};				// arenas allocated so far
+	uint8_t*		arenas[YY_POOL_ARENAS]{};
+	void*			freeList{};				// first free item, each points to the next
+	uint16_t		used{};					// items handed out
+	uint16_t		peak{};					// most ever handed out
+};
+
+// Routines in Pool_YY.cpp
+void*			YY_PoolGet(YY_POOL* pool);
+void			YY_PoolPut(YY_POOL* pool, void* item);
+void*			YY_PoolItem(YY_POOL* pool, uint16_t index);
+uint16_t		YY_PoolIndex(YY_POOL* pool, void* item);
+
+// Routines in Cache_YY.cpp
+uint8_t*		YY_GetSector(HANDLE hDevice, uint32_t sector, bool bRead=true);	// pin a sector in the cache
+void			YY_ReleaseSector(void* buffer, bool bDirty=false);				// unpin it
+bool			YY_ReadSector(HANDLE hDevice, uint32_t sector, void* buffer, bool bKeep=true);	// copy out
+bool			YY_WriteSector(HANDLE hDevice, uint32_t sector, const void* buffer);	// copy in
+bool			YY_ReadSectors(HANDLE hDevice, uint32_t sector, uint32_t count, void* buffer);	// uncached run
+bool			YY_WriteSectors(HANDLE hDevice, uint32_t sector, uint32_t count, const void* buffer);
+void			YY_PrefetchSectors(HANDLE hDevice, uint32_t sector, uint16_t count);
+bool			YY_FlushCache(HANDLE hDevice);
+void			YY_InvalidateCache(HANDLE hDevice);
+
+// Routines in Drive_YY.cpp
 YY_DRIVE*		YY_MountDrive(uint8_t idDevice);
+void			YY_UnmountDrive(YY_DRIVE* drive);
+bool			YY_MapDrive(uint8_t idDrive, const char* device, uint8_t partition, uint8_t flags=0);
+int				YY_LoadDriveMap(const char* fileName);
+void			YY_UpdateFSInfo(YY_DRIVE* drive);
+bool			YY_isFatPartition(uint8_t type);
+YY_DRIVE*		YY_PathDrive(const uint16_t* path);							// mounted drive a path is on
+void			YY_LockDrive(YY_DRIVE* drive, bool bShared);
+void			YY_UnlockDrive(YY_DRIVE* drive, bool bShared);
+void			YY_LockFat(YY_DRIVE* drive);								// the FAT buffers for readers
+void			YY_UnlockFat(YY_DRIVE* drive);
 
 // Routines in Clusters_YY.cpp
 uint32_t		YY_ClusterToSector(YY_DRIVE* drive, uint32_t c);
 uint32_t		YY_SectorToCluster(YY_DRIVE* drive, uint32_t s);
 void			YY_FlushFAT(YY_DRIVE* drive);
-uint32_t		YY_GetClusterEntry(YY_DRIVE* drive, uint32_t cluster);
+void			YY_SetFatOps(YY_DRIVE* drive);
+uint32_t		YY_GetClusterEntry(YY_DRIVE* drive, uint32_t cluster, bool bHeld=false);	// bHeld: you hold the FAT or the drive
 void			YY_SetClusterEntry(YY_DRIVE* drive, uint32_t cluster, uint32_t value);
 uint32_t		YY_AllocateCluster(YY_DRIVE* drive);
-uint32_t		YY_GetNextSector(YY_DRIVE* drive, uint32_t current_sector);
+uint32_t		YY_AllocateClusters(YY_DRIVE* drive, uint32_t n, uint32_t hint=0);
+uint32_t		YY_ExtendChain(YY_DRIVE* drive, uint32_t last, uint32_t n);
+void			YY_FreeChain(YY_DRIVE* drive, uint32_t cluster);
+uint32_t		YY_FreeClusters(YY_DRIVE* drive);
+uint32_t		YY_BadClusters(YY_DRIVE* drive);
+void			YY_BuildFreeMap(YY_DRIVE* drive);
+void			YY_LoadFat12(YY_DRIVE* drive);
+bool			YY_EndOfChain(YY_DRIVE* drive, uint32_t entry);
+uint32_t		YY_ChainRun(YY_DRIVE* drive, uint32_t cluster, uint32_t max, bool bHeld=false);
+uint32_t		YY_GetNextSector(YY_DRIVE* drive, uint32_t current_sector, bool bHeld=false);
 
 // Routines/Data in Directories_YY.cpp
 extern uint8_t	YY_defaultDrive;
@@ -138,26 +465,56 @@ YY_DIRECTORY*	YY_OpenDirectory(uint16_t* path);
 bool			YY_ChangeDirectory(YY_DIRECTORY* dir, uint16_t* path);
 void			YY_ResetDirectory(YY_DIRECTORY* dir);
 
+YY_FILE*		YY_FindDirectoryItem(YY_DIRECTORY* dir, uint16_t* name);
+YY_FILE*		YY_CreateItem(YY_DIRECTORY* dir, uint16_t* name, uint8_t attr);
+bool			YY_UpdateItem(YY_FILE* file);
+void			YY_NameAdded(YY_DIRECTORY* dir, YY_FILE* file);
+void			YY_ForgetNames(YY_DRIVE* drive, uint32_t dirCluster=0xffffffff);
 void			YY_CloseDirectory(YY_DIRECTORY* dir);
 void			YY_DirFlush(YY_DIRECTORY* dir);
 YY_FILE*		YY_NextDirectoryItem(YY_DIRECTORY* dir);
+uint16_t		YY_ReadDirectory(YY_DIRECTORY* dir, YY_DIRENTRY* out, uint16_t max, uint16_t* names, uint16_t cbNames, uint8_t flags=0);
+void			YY_UnreadDirectory(YY_DIRECTORY* dir, YY_DIRENTRY* entry);
+YY_FILE*		YY_DirectoryItemAt(YY_DIRECTORY* dir, YY_DIRENTRY* entry);
+YY_DIRECTORY*	YY_OpenDirectoryAt(YY_DIRECTORY* parent, YY_DIRENTRY* entry);
+YY_DIRECTORY*	YY_OpenDirectoryCluster(YY_DRIVE* drive, uint32_t startCluster, const uint16_t* longPath);
+
+// Routines in Walk_YY.cpp
+bool			YY_Walk(YY_DIRECTORY* dir, uint8_t flags, YY_WALKITEM onItem, YY_WALKDONE onFolder, void* user, uint16_t nThreads=0);
+uint32_t		YY_CRC32(uint32_t crc, const void* data, uint32_t count);
 const char*		YY_WriteDirectoryItem(YY_FILE* file, uint8_t* buffer, int cb=0);
 
+// Routines in Format_YY.cpp
+bool			YY_Format(HANDLE hDevice, uint32_t firstSector, YY_FORMAT* fmt);	// device not mounted please
+uint8_t			YY_PartitionType(uint8_t fatType, uint32_t nSectors);
+bool			YY_WritePartitions(HANDLE hDevice, BOOT_SECTOR::PARTITION* table, uint8_t n);
+
 // Routines in Files_YY.cpp
 YY_FILE*		YY_GetFileSlot();
 void			YY_FreeFileSlot(YY_FILE* file);
+YY_PATH*		YY_SharePath(YY_PATH* path);
+void			YY_ReleasePath(YY_PATH* path);
 bool			YY_isDIR(YY_FILE* file);
 bool			YY_isFILE(YY_FILE* file);
 uint8_t			YY_isOpen(YY_FILE* file);
 bool			YY_matchName(YY_FILE* file, uint16_t* name);
-YY_FILE*		YY_OpenFile(uint16_t* path, uint8_t mode);
-YY_FILE*		YY_OpenFileDirect(YY_FILE* file, uint8_t mode);
+YY_FILE*		YY_OpenFile(uint16_t* path, uint8_t mode, uint32_t expect=0);	// expect=bytes we'll write
+YY_FILE*		YY_OpenFileDirect(YY_FILE* file, uint8_t mode, uint32_t expect=0);
 void			YY_CloseFile(YY_FILE* file);
+bool			YY_SeekFile(YY_FILE* file, uint32_t dest);
+uint32_t		YY_TellFile(YY_FILE* file);
 uint16_t		YY_getc(YY_FILE* file);
+uint32_t		YY_ReadFile(YY_FILE* file, void* buffer, uint32_t count);
+uint32_t		YY_WriteFile(YY_FILE* file, const void* buffer, uint32_t count);
+bool			YY_putc(YY_FILE* file, uint8_t c);
+bool			YY_FlushFile(YY_FILE* file);
 
 // Routines in Chars_YY.cpp
 uint16_t*		YY_ToWide(uint16_t* output, uint16_t cbOut, const uint8_t* input, uint16_t cbIn=0xffff);
 uint8_t*		YY_ToNarrow(uint8_t* output, uint16_t cbOut, const uint16_t* input, uint16_t cbIn=0xffff);
+uint16_t		YY_Fold(uint16_t c);
+uint16_t		YY_WideLen(const uint16_t* text);
+uint16_t*		YY_WideCat(uint16_t* dest, uint16_t cbDest, const uint16_t* src);
 
 // debugs
 int YY_Dused();
@@ -5,48 +5,74 @@
 #include <cstdio>
 #include <cstdint>
 #include <cassert>
+#include <cstring>
 #include <inttypes.h>		// see: https://en.cppreference.com/w/cpp/types/integer for printf'ing silly things
-#include <windows.h>
+#include "FAT_OS.h"		// <windows.h> or the bits of it we need
 
 #include "FAT_XX.h"
 #include "FAT_YY.h"
 #include "FAT_ZZ.h"
 
 //=================================================================================================
-// semi static ZZ_DRIVE/FOLDER/FILE allocator
+// ZZ_DRIVE/FOLDER/FILE handles
+// What the caller gets isn't a pointer, it's the thing's index in the pool (+1 so it's never 0)
+// with the thing's generation in the top 16 bits. Freeing a thing bumps its generation so a handle
+// used after ZZ_fclose() (or twice) no longer matches and gets refused rather than quietly
+// working on whatever file has moved into the slot since.
 //=================================================================================================
-#define N_THINGS 100
-struct ZZ_THING { void* y; } zz_things[N_THINGS]{};		// they are all the same so...
+#ifndef ZZ_HANDLES_PER_ARENA
+#define ZZ_HANDLES_PER_ARENA	128
+#endif
+struct ZZ_THING { void* y; uint16_t gen; };			// they are all the same so...
+static YY_POOL things{ sizeof(ZZ_THING), ZZ_HANDLES_PER_ARENA };
 
-static ZZ_THING* getthing(void* p){
-	for(int i=0; i<N_THINGS; ++i)
-		if(zz_things[i].y==nullptr){
-			zz_things[i].y = p;
-			return &zz_things[i];
-		}
-	return nullptr;
+static void* getthing(void* p){
+	if(p==nullptr) return nullptr;
+	ZZ_THING* t = (ZZ_THING*)YY_PoolGet(&things);
+	if(t==nullptr){
+		printf("Out of ZZ handles (%d in use)\n", things.used);
+		return nullptr;
+	}
+	t->y = p;
+	uint32_t index = YY_PoolIndex(&things, t);
+	return (void*)(uintptr_t)(((uint32_t)t->gen<<16) | (index+1));
 }
-static void freething(void* t)
+static ZZ_THING* lookup(const void* h)
 {
-	((ZZ_THING*)t)->y = nullptr;
+	if(h==nullptr) return nullptr;
+	uintptr_t v = (uintptr_t)h;
+	ZZ_THING* t = (ZZ_THING*)YY_PoolItem(&things, (uint16_t)((v & 0xffff)-1));
+	if(t==nullptr || t->gen!=(uint16_t)(v>>16) || (v>>16)>0xffff){
+		printf("Stale or bad ZZ handle %p\n", h);
+		return nullptr;
+	}
+	return t;
+}
+static void* thing(const void* h)
+{
+	ZZ_THING* t = lookup(h);
+	return t ? t->y : nullptr;
+}
+static void freething(void* h)
+{
+	ZZ_THING* t = lookup(h);
+	if(t==nullptr) return;
+	++t->gen;										// every handle to it is now stale
+	YY_PoolPut(&things, t);
 }
 #if _DEBUG
 int UsedZZthings()
 {
-	int n=0;
-	for(int i=0; i<N_THINGS; ++i)
-		if(zz_things[i].y!=nullptr)
-			++n;
-	return n;
+	return things.used;
 }
 #endif
 
 ZZ_DRIVE*	allocateDRIVE(YY_DRIVE* y)	{ return (ZZ_DRIVE*)getthing(y); }
-void		freeDRIVE(ZZ_DRIVE* z)		{ z->drive_stuff = nullptr; }
-ZZ_FOLDER*	allocateFOLDER(YY_DIRECTORY* y){ return (ZZ_FOLDER*)getthing(y); }
-void		freeFOLDER(ZZ_FOLDER* z)	{ YY_CloseDirectory((YY_DIRECTORY*)(z->folder_stuff)); z->folder_stuff = nullptr; }
-ZZ_FILE*	allocateFILE(YY_FILE* y)	{ return (ZZ_FILE*)getthing(y); }
-void		freeFILE(ZZ_FILE* z)		{ YY_CloseFile((YY_FILE*)(z->file_stuff)); z->file_stuff = nullptr; }
+void		freeDRIVE(ZZ_DRIVE* z)		{ freething(z); }
+ZZ_FOLDER*	allocateFOLDER(YY_DIRECTORY* y){ void* h = getthing(y); if(h==nullptr && y) YY_CloseDirectory(y); return (ZZ_FOLDER*)h; }
+void		freeFOLDER(ZZ_FOLDER* z)	{ YY_DIRECTORY* y = (YY_DIRECTORY*)thing(z); if(y){ YY_CloseDirectory(y); freething(z); } }
+ZZ_FILE*	allocateFILE(YY_FILE* y)	{ void* h = getthing(y); if(h==nullptr && y) YY_CloseFile(y); return (ZZ_FILE*)h; }
+void		freeFILE(ZZ_FILE* z)		{ YY_FILE* y = (YY_FILE*)thing(z); if(y){ YY_CloseFile(y); freething(z); } }
 
 // find the index of the first character of the actual file name.ext
 #if 0
@@ -64,42 +90,56 @@ static uint16_t split(const uint8_t* full)
 #endif
 //=================================================================================================
 // text management for utf8/utf16 translation
+// Paths coming in are converted into a buffer on the caller's stack and names going out are
+// written into a buffer the caller passes so nothing is shared between calls (or threads)
 //=================================================================================================
-// slots and a next slot pointer
-uint8_t textslot[20][MAX_PATH];
-uint8_t nslot=0;
-
-static uint8_t* totext(const uint16_t* in=nullptr){
-	if(++nslot>=20) nslot=0;
-	if(in==nullptr) return textslot[nslot];
-	return YY_ToNarrow(textslot[nslot], MAX_PATH, in);
-}
-// again in wide
-uint16_t wideslot[20][MAX_PATH];
-uint8_t wslot=0;
+typedef uint16_t WIDEPATH[MAX_PATH];
+static const uint16_t noText[] = { 0 };
 
-static uint16_t* towide(const uint8_t* in){
+static uint16_t* towide(uint16_t* wide, const uint8_t* in){
 	if(in==nullptr) return nullptr;
-	if(++wslot>=20) wslot=0;
-	return YY_ToWide(wideslot[nslot], MAX_PATH, in);
+	return YY_ToWide(wide, MAX_PATH, in);
 }
+static uint8_t* totext(uint8_t* buffer, uint16_t cb, const uint16_t* in){
+	if(buffer==nullptr || cb==0) return (uint8_t*)u8"";
+	return YY_ToNarrow(buffer, cb, in);
+}
+//=================================================================================================
+// Drive locks
+// Each call holds its drive's lock while it is down in the YY_ layer, shared if all it does is read
+// and alone if it might write, so any number of readers can work on a drive at once. The YY_
+// routines don't take the drive lock themselves so if you call them directly hold it as these do.
+// The name, size and flag getters only look at the handle and don't bother.
+//=================================================================================================
+static YY_DRIVE* lockdrive(YY_DRIVE* drive, bool bShared)
+{
+	if(drive) YY_LockDrive(drive, bShared);
+	return drive;
+}
+static void unlockdrive(YY_DRIVE* drive, bool bShared)
+{
+	if(drive) YY_UnlockDrive(drive, bShared);
+}
+// a file opened for writing changes its drive so it has it to itself
+inline bool reading(YY_FILE* fy){ return (fy->open_mode & FOM_WRITE)==0; }
+
 //=================================================================================================
 // File routines
 //=================================================================================================
 
-inline YY_FILE* getfile(ZZ_FILE* fz){ if(fz==nullptr) return nullptr; return (YY_FILE*)(fz->file_stuff); }
+inline YY_FILE* getfile(ZZ_FILE* fz){ return (YY_FILE*)thing(fz); }
 
-const uint8_t* ZZ_longpath(ZZ_FILE* fz)
+const uint8_t* ZZ_longpath(ZZ_FILE* fz, uint8_t* buffer, uint16_t cb)
 {
 	YY_FILE* fy = getfile(fz);
-	if(fy==nullptr) return (uint8_t*)u8"";
-	return totext(fy->pathName);
+	if(fy==nullptr || fy->path==nullptr) return totext(buffer, cb, noText);
+	return totext(buffer, cb, fy->path->text);
 }
-const uint8_t* ZZ_longname(ZZ_FILE* fz)
+const uint8_t* ZZ_longname(ZZ_FILE* fz, uint8_t* buffer, uint16_t cb)
 {
 	YY_FILE* fy = getfile(fz);
-	if(fy==nullptr) return (uint8_t*)u8"";
-	return totext(fy->longName);
+	if(fy==nullptr) return totext(buffer, cb, noText);
+	return totext(buffer, cb, fy->longName);
 }
 uint32_t ZZ_filesize(ZZ_FILE* fz)
 {
@@ -117,24 +157,31 @@ struct { uint8_t mode1, mode2; uint8_t code; } modes[] = {
 	'a',  '+',	FOM_READ | FOM_WRITE | FOM_APPEND
 };
 
-ZZ_FILE* ZZ_fopen(const uint8_t* pathname, const uint8_t* mode)
+ZZ_FILE* ZZ_fopen(const uint8_t* pathname, const uint8_t* mode, uint32_t expect)
 {
 	uint8_t code{};
-	for(int a=0; a<_countof(modes); ++a)
+	for(size_t a=0; a<_countof(modes); ++a)
 		if(modes[a].mode1 == mode[0] && modes[a].mode2 == mode[1]){
 			code = modes[a].code;
 			break;
 		}
 	if(code==0) return nullptr;
 
-	YY_FILE* file = YY_OpenFile(towide(pathname), code);
-	if(file==nullptr) return nullptr;
-	return allocateFILE(file);
+	WIDEPATH wide;
+	if(towide(wide, pathname)==nullptr) return nullptr;
+	bool bShared = (code & FOM_WRITE)==0;
+	YY_DRIVE* drive = lockdrive(YY_PathDrive(wide), bShared);
+	if(drive==nullptr) return nullptr;
+	ZZ_FILE* fz = nullptr;
+	YY_FILE* file = YY_OpenFile(wide, code, expect);
+	if(file) fz = allocateFILE(file);
+	unlockdrive(drive, bShared);
+	return fz;
 }
 ZZ_FILE* ZZ_fopenD(ZZ_FILE* fz, const uint8_t* mode)
 {
 	uint8_t code{};
-	for(int a=0; a<_countof(modes); ++a)
+	for(size_t a=0; a<_countof(modes); ++a)
 		if(modes[a].mode1 == mode[0] && modes[a].mode2 == mode[1]){
 			code = modes[a].code;
 			break;
@@ -142,7 +189,11 @@ ZZ_FILE* ZZ_fopenD(ZZ_FILE* fz, const uint8_t* mode)
 	if(code==0) return nullptr;
 
 	YY_FILE* fy = getfile(fz);
+	if(fy==nullptr) return nullptr;
+	bool bShared = (code & FOM_WRITE)==0;
+	YY_DRIVE* drive = lockdrive(fy->drive, bShared);
 	fy = YY_OpenFileDirect(fy, code);
+	unlockdrive(drive, bShared);
 	if(fy==nullptr) return nullptr;
 	return fz;
 }
@@ -150,105 +201,119 @@ ZZ_FILE* ZZ_fopenD(ZZ_FILE* fz, const uint8_t* mode)
 void ZZ_fclose(ZZ_FILE* fz)
 {
 	YY_FILE* fy = getfile(fz);
-	if(fy!=nullptr)
-		YY_CloseFile(fy);
-	freeFILE(fz);
+	if(fy!=nullptr){
+		bool bShared = reading(fy);
+		YY_DRIVE* drive = lockdrive(fy->drive, bShared);	// fy is gone after this
+		freeFILE(fz);				// closes it
+		unlockdrive(drive, bShared);
+	}
 }
 uint32_t ZZ_fread(void* buffer, uint16_t count, ZZ_FILE* fz)
 {
 	YY_FILE* fy = getfile(fz);
-	if(fy!=nullptr){
-		uint16_t i=0;
-		while(i<count){
-			uint16_t c = YY_getc(fy);
-			if(c==ZZ_EOF)
-				return i;
-			((uint8_t*)buffer)[i++] = c & 0xff;
-		}
-		return count;
-	}
-	return 0;
+	if(fy==nullptr) return 0;
+	bool bShared = reading(fy);
+	YY_DRIVE* drive = lockdrive(fy->drive, bShared);
+	uint32_t n = YY_ReadFile(fy, buffer, count);
+	unlockdrive(drive, bShared);
+	return n;
 }
 uint16_t ZZ_fgetc(ZZ_FILE* fz)
 {
 	YY_FILE* fy = getfile(fz);
-	if(fy!=nullptr)
-		return YY_getc(fy);
-	return 0;
+	if(fy==nullptr) return 0;
+	bool bShared = reading(fy);
+	YY_DRIVE* drive = lockdrive(fy->drive, bShared);
+	uint16_t c = YY_getc(fy);
+	unlockdrive(drive, bShared);
+	return c;
 }
 uint8_t* ZZ_fgets(uint8_t* buffer, uint16_t count, ZZ_FILE* fz)
 {
 	YY_FILE* fy = getfile(fz);
-	if(fy!=nullptr){
-		uint16_t i=0;
-		while(i<count-1){
-			uint16_t c = YY_getc(fy);
-			if(c==ZZ_EOF){
-				if(i==0) return nullptr;
-				buffer[i] = 0;
-				return buffer;
-			}
-			if(c=='\n'){
-				buffer[i] = 0;
-				return buffer;
-			}
-			buffer[i++] = c & 0xff;
+	if(fy==nullptr) return nullptr;
+	bool bShared = reading(fy);
+	YY_DRIVE* drive = lockdrive(fy->drive, bShared);
+	uint16_t i=0;
+	while(i<count-1){
+		uint16_t c = YY_getc(fy);
+		if(c==ZZ_EOF){
+			if(i==0) buffer = nullptr;
+			break;
 		}
-		buffer[i] = 0;
-		return buffer;
+		if(c=='\n') break;
+		buffer[i++] = c & 0xff;
 	}
-	return nullptr;
+	if(buffer) buffer[i] = 0;
+	unlockdrive(drive, bShared);
+	return buffer;
 }
 uint32_t ZZ_fwrite(void* buffer, uint16_t count, ZZ_FILE* fz)
 {
 	YY_FILE* fy = getfile(fz);
-	if(fy!=nullptr){
-
-
-
-
-	}
-	return 0;
+	if(fy==nullptr) return 0;
+	bool bShared = reading(fy);
+	YY_DRIVE* drive = lockdrive(fy->drive, bShared);
+	uint32_t n = YY_WriteFile(fy, buffer, count);
+	unlockdrive(drive, bShared);
+	return n;
 }
 int ZZ_fputc(uint8_t c, ZZ_FILE* fz)
 {
 	YY_FILE* fy = getfile(fz);
-	if(fy!=nullptr){
-
-
-
-	}
-	return 0;
+	if(fy==nullptr) return ZZ_EOF;
+	bool bShared = reading(fy);
+	YY_DRIVE* drive = lockdrive(fy->drive, bShared);
+	bool ok = YY_putc(fy, c);
+	unlockdrive(drive, bShared);
+	return ok ? c : ZZ_EOF;
 }
 int ZZ_fputs(uint8_t* str, ZZ_FILE* fz)
 {
 	YY_FILE* fy = getfile(fz);
-	if(fy!=nullptr){
-
-
-	}
-	return 0;
+	if(fy==nullptr) return ZZ_EOF;
+	uint32_t n = 0;
+	while(str[n]) ++n;
+	bool bShared = reading(fy);
+	YY_DRIVE* drive = lockdrive(fy->drive, bShared);
+	bool ok = YY_WriteFile(fy, str, n)==n;
+	unlockdrive(drive, bShared);
+	return ok ? 0 : ZZ_EOF;
+}
+uint8_t ZZ_fflush(ZZ_FILE* fz)
+{
+	YY_FILE* fy = getfile(fz);
+	if(fy==nullptr) return 1;
+	bool bShared = reading(fy);
+	YY_DRIVE* drive = lockdrive(fy->drive, bShared);
+	bool ok = YY_FlushFile(fy);
+	unlockdrive(drive, bShared);
+	return ok ? 0 : 1;
 }
 uint8_t ZZ_fseek(ZZ_FILE* fz, int32_t offset, uint8_t origin)
 {
 	YY_FILE* fy = getfile(fz);
 	if(fy!=nullptr){
+		int64_t dest;
 		switch(origin){
 		case 0:				// SEEK_SET
-			if(offset<0 || offset>fy->dirn.DIR_FileSize) return 1;
-			fy->filePointer = offset;
-			return 0;
+			dest = offset;
+			break;
 		case 1:				// SEEK_CUR
-			if(offset<0 && -offset>fy->filePointer) return 1;
-			if(offset>0 && (offset+fy->filePointer) > fy->dirn.DIR_FileSize) return 1;
-			fy->filePointer += offset;
-			return 0;
+			dest = (int64_t)YY_TellFile(fy) + offset;
+			break;
 		case 2:				// SEEK_END
-			if(offset>0) return 1;
-			if(-offset>fy->dirn.DIR_FileSize) return 1;
-			fy->filePointer = fy->dirn.DIR_FileSize+offset;
-			return 0;
+			dest = (int64_t)fy->dirn.DIR_FileSize + offset;
+			break;
+		default:
+			return 1;
 		}
+		if(dest<0 || dest>0xffffffff) return 1;
+		bool bShared = reading(fy);
+		YY_DRIVE* drive = lockdrive(fy->drive, bShared);	// a dirty buffer goes out first
+		bool ok = YY_SeekFile(fy, (uint32_t)dest);
+		unlockdrive(drive, bShared);
+		return ok ? 0 : 1;
 	}
 	return 1;
 }
@@ -256,14 +321,14 @@ uint32_t ZZ_ftell(ZZ_FILE* fz)
 {
 	YY_FILE* fy = getfile(fz);
 	if(fy!=nullptr)
-		return fy->filePointer;
+		return YY_TellFile(fy);
 	return 0;
 }
-const char* ZZ_writefiledesc(ZZ_FILE* fz)
+const char* ZZ_writefiledesc(ZZ_FILE* fz, char* buffer, uint16_t cb)
 {
 	YY_FILE* fy = getfile(fz);
-	if(fy!=nullptr)
-		return YY_WriteDirectoryItem(fy, totext(), MAX_PATH);
+	if(fy!=nullptr && buffer!=nullptr && cb!=0)
+		return YY_WriteDirectoryItem(fy, (uint8_t*)buffer, cb);
 	return "";
 }
 bool ZZ_isDIR(ZZ_FILE* fz)
@@ -290,30 +355,40 @@ uint8_t ZZ_isOpen(ZZ_FILE* fz)
 //=================================================================================================
 // folder routines
 //=================================================================================================
-inline YY_DIRECTORY* getfolder(ZZ_FOLDER* fz){ if(fz==nullptr) return nullptr; return (YY_DIRECTORY*)(fz->folder_stuff); }
+inline YY_DIRECTORY* getfolder(ZZ_FOLDER* fz){ return (YY_DIRECTORY*)thing(fz); }
 
 ZZ_FOLDER* ZZ_openfolder(const uint8_t* pathname)
 {
 	assert(ZZ_EOF==YY_EOF);
 
-	return allocateFOLDER(YY_OpenDirectory(towide(pathname)));
+	WIDEPATH wide;
+	if(towide(wide, pathname)==nullptr) return nullptr;
+	YY_DRIVE* drive = lockdrive(YY_PathDrive(wide), true);
+	if(drive==nullptr) return nullptr;
+	ZZ_FOLDER* fz = allocateFOLDER(YY_OpenDirectory(wide));
+	unlockdrive(drive, true);
+	return fz;
 }
 bool ZZ_changefolder(ZZ_FOLDER* fz, const uint8_t* path )
 {
 	YY_DIRECTORY* fy = getfolder(fz);
-	if(fy!=nullptr)
-		return YY_ChangeDirectory(fy, towide(path));
-	return false;
+	WIDEPATH wide;
+	if(fy==nullptr) return false;
+	YY_DRIVE* drive = lockdrive(fy->drive, true);
+	bool ok = YY_ChangeDirectory(fy, towide(wide, path));
+	unlockdrive(drive, true);
+	return ok;
 }
 ZZ_FILE* ZZ_findnextfile(ZZ_FOLDER* fz)
 {
 	YY_DIRECTORY* fy = getfolder(fz);
-	if(fy!=nullptr){
-		YY_FILE* file = YY_NextDirectoryItem(fy);
-		if(file==nullptr) return nullptr;
-		return allocateFILE(file);
-	}
-	return nullptr;
+	if(fy==nullptr) return nullptr;
+	YY_DRIVE* drive = lockdrive(fy->drive, true);
+	ZZ_FILE* file = nullptr;
+	YY_FILE* item = YY_NextDirectoryItem(fy);
+	if(item) file = allocateFILE(item);
+	unlockdrive(drive, true);
+	return file;
 }
 void ZZ_resetfolder(ZZ_FOLDER* fz)
 {
@@ -321,16 +396,135 @@ void ZZ_resetfolder(ZZ_FOLDER* fz)
 	if(fy!=nullptr)
 		YY_ResetDirectory(fy);
 }
-uint8_t* ZZ_folderpathname(ZZ_FOLDER* fz)
+const uint8_t* ZZ_folderpathname(ZZ_FOLDER* fz, uint8_t* buffer, uint16_t cb)
 {
 	YY_DIRECTORY* fy = getfolder(fz);
 	if(fy!=nullptr)
-		return totext(fy->longPath);
-	return (uint8_t*)"";
+		return totext(buffer, cb, fy->longPath);
+	return totext(buffer, cb, noText);
 }
 void ZZ_closefolder(ZZ_FOLDER* fz)
 {
 	YY_DIRECTORY* fy = getfolder(fz);
-	if(fy!=nullptr)
-		YY_CloseDirectory(fy);
+	if(fy==nullptr) return;
+	YY_DRIVE* drive = lockdrive(fy->drive, true);
+	freeFOLDER(fz);					// closes it
+	unlockdrive(drive, true);
+}
+// fill out[] with as many items as there are room for, 0 at the end
+// the names come through a batch at a time in wide characters and then go into names[] as utf8
+// if even the first name won't fit you get as much of it as will so 0 is never "names too small"
+// all the working space is on the stack so two folders can be read at once
+#define ZZ_BATCH	32
+
+static void toDirent(ZZ_DIRENT* e, YY_DIRENTRY* y, uint8_t* name)
+{
+	e->name	  = name;
+	e->size	  = y->dirn.DIR_FileSize;
+	e->date	  = y->dirn.DIR_WrtDate;
+	e->time	  = y->dirn.DIR_WrtTime;
+	e->attr	  = y->dirn.DIR_Attr;
+	e->sector = y->dirSector;
+	e->slot	  = y->dirSlot;
+}
+static uint8_t emptyName[1];			// for a name cut short to nothing
+uint16_t ZZ_readfolder(ZZ_FOLDER* fz, ZZ_DIRENT* out, uint16_t max, uint8_t* names, uint16_t cbNames, uint8_t flags)
+{
+	assert(ZZ_SHORTNAMES==RDF_SHORTNAMES && ZZ_NOHIDDEN==RDF_NOHIDDEN && ZZ_NODOTS==RDF_NODOTS);
+
+	YY_DIRECTORY* fy = getfolder(fz);
+	if(fy==nullptr) return 0;
+	YY_DIRENTRY	batch[ZZ_BATCH];
+	uint16_t	batchNames[ZZ_BATCH*16];					// most names are short and it stops early if not
+	uint8_t		narrow[3*MAX_PATH];
+	uint16_t n=0, used=0;
+	YY_DRIVE* drive = lockdrive(fy->drive, true);
+	while(n<max){
+		uint16_t want = max-n<ZZ_BATCH ? max-n : ZZ_BATCH;
+		uint16_t got = YY_ReadDirectory(fy, batch, want, batchNames, _countof(batchNames), flags);
+		if(got==0) break;
+		for(uint16_t i=0; i<got; ++i){
+			YY_ToNarrow(narrow, sizeof narrow, batch[i].name);
+			uint16_t len = (uint16_t)strlen((char*)narrow)+1;
+			if(used+len > cbNames){
+				if(n){								// it can wait for next time
+					YY_UnreadDirectory(fy, &batch[i]);
+					max = n;						// and that's this lot done
+					break;
+				}
+				len = cbNames;						// the first one so cut it short on a whole character
+				while(len>1 && (narrow[len-1] & 0xc0)==0x80) --len;
+				if(len) narrow[len-1] = 0;
+				if(i+1<got) YY_UnreadDirectory(fy, &batch[i+1]);
+				max = 1;
+			}
+			toDirent(&out[n++], &batch[i], len ? names+used : emptyName);
+			memcpy(names+used, narrow, len);
+			used += len;
+			if(n==max) break;
+		}
+	}
+	unlockdrive(drive, true);
+	return n;
+}
+// get a ZZ_FILE for an item ZZ_readfolder() gave you
+ZZ_FILE* ZZ_openentry(ZZ_FOLDER* fz, ZZ_DIRENT* entry)
+{
+	YY_DIRECTORY* fy = getfolder(fz);
+	if(fy==nullptr || entry==nullptr) return nullptr;
+	YY_DIRENTRY e{};
+	e.dirSector = entry->sector;
+	e.dirSlot	= entry->slot;
+	YY_DRIVE* drive = lockdrive(fy->drive, true);
+	ZZ_FILE* handle = nullptr;
+	YY_FILE* file = YY_DirectoryItemAt(fy, &e);
+	if(file) handle = allocateFILE(file);
+	unlockdrive(drive, true);
+	return handle;
+}
+//=================================================================================================
+// walking a tree
+//=================================================================================================
+// YY_Walk() calls these one at a time so they can share the buffers and they pass it on in utf8
+struct WALK { ZZ_WALKITEM onItem; ZZ_WALKDONE onFolder; void* user; uint8_t path[3*MAX_PATH], name[3*MAX_PATH]; };
+
+static bool walkItem(YY_DIRECTORY* dir, YY_DIRENTRY* entry, uint32_t crc, void* user)
+{
+	WALK* w = (WALK*)user;
+	if(w->onItem==nullptr) return true;
+	ZZ_DIRENT e;
+	toDirent(&e, entry, YY_ToNarrow(w->name, sizeof w->name, entry->name));
+	return w->onItem(totext(w->path, sizeof w->path, dir->longPath), &e, crc, w->user);
+}
+static bool walkFolder(YY_WALKFOLDER* folder, void* user)
+{
+	WALK* w = (WALK*)user;
+	if(w->onFolder==nullptr) return true;
+	ZZ_WALKFOLDER f;
+	f.path	   = totext(w->path, sizeof w->path, folder->path);
+	f.depth	   = folder->depth;
+	f.files	   = folder->files;
+	f.folders  = folder->folders;
+	f.bytes	   = folder->bytes;
+	f.checksum = folder->checksum;
+	f.errors   = folder->errors;
+	return w->onFolder(&f, w->user);
+}
+bool ZZ_walk(const uint8_t* pathname, uint8_t flags, ZZ_WALKITEM onItem, ZZ_WALKDONE onFolder, void* user, uint16_t nThreads)
+{
+	assert(ZZ_CHECKSUM==WALK_CHECKSUM);
+
+	WIDEPATH wide;
+	if(towide(wide, pathname)==nullptr) return false;
+	YY_DRIVE* drive = lockdrive(YY_PathDrive(wide), true);	// for the whole walk and all its workers
+	if(drive==nullptr) return false;
+	bool ret = false;
+	YY_DIRECTORY* dir = YY_OpenDirectory(wide);
+	if(dir){
+		WALK w{ onItem, onFolder, user, {}, {} };
+		ret = YY_Walk(dir, flags, walkItem, walkFolder, &w, nThreads);
+		YY_CloseDirectory(dir);
+	}
+	unlockdrive(drive, true);
+	return ret;
 }
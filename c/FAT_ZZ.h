@@ -4,21 +4,19 @@
 #define U8	const uint8_t*
 #define U16	const uint16_t*
 
-//#define ZZ_FILE YY_FILE
-struct ZZ_FILE {
-	void* file_stuff{};
-};
-struct ZZ_FOLDER {
-	void* folder_stuff{};
-};
-struct ZZ_DRIVE {
-	void* drive_stuff{};
-};
+// handles, never dereferenced, see FAT_ZZ.cpp
+// any thread can use any handle but two threads mustn't use the same one at once
+struct ZZ_FILE;
+struct ZZ_FOLDER;
+struct ZZ_DRIVE;
 
 #if _DEBUG
 int UsedFileSlots();
 int UsedDirectorySlots();
 int UsedZZthings();
+void FatCacheStats(uint8_t idDrive, uint32_t* hits, uint32_t* misses);
+void CacheStats(uint32_t* hits, uint32_t* misses);
+void NameCacheStats(uint32_t* hits, uint32_t* misses);
 #endif
 
 // defined data
@@ -26,8 +24,38 @@ extern uint8_t ZZ_CWD[MAX_PATH];		// starts a "C:\"
 
 #define ZZ_EOF	0xffff
 
+// what ZZ_readfolder() gives back for each item
+struct ZZ_DIRENT {
+	uint8_t*	name;				// utf8 in the names buffer you gave it, cut short if it alone is too big
+	uint32_t	size;
+	uint16_t	date, time;			// last written in FAT format
+	uint8_t		attr;				// ATTR_ bits
+	uint32_t	sector;				// where it is so ZZ_openentry() can find it
+	uint8_t		slot;
+};
+// ZZ_readfolder() flags
+#define ZZ_SHORTNAMES	0x01		// just the 8.3 names, it's quicker
+#define ZZ_NOHIDDEN		0x02		// leave out hidden and system items
+#define ZZ_NODOTS		0x04		// leave out "." and ".."
+#define ZZ_CHECKSUM		0x80		// ZZ_walk() reads every file for its CRC32
+
+// what ZZ_walk() tells you about each folder when it has read it all
+struct ZZ_WALKFOLDER {
+	const uint8_t*	path;			// utf8 "C:/folder/"
+	uint16_t		depth;			// 0 for where you started
+	uint32_t		files;			// in it, not below it
+	uint32_t		folders;
+	uint64_t		bytes;
+	uint32_t		checksum;		// CRC32 of its files' CRC32s in directory order if ZZ_CHECKSUM
+	uint32_t		errors;			// files that wouldn't read, 1 and nothing else if it wouldn't open
+};
+// ZZ_walk() has the drive read locked while it calls these so they can read it but not write it.
+// The walk runs on several threads and they can come from any of them but only one at a time.
+typedef bool (*ZZ_WALKITEM)(const uint8_t* path, ZZ_DIRENT* entry, uint32_t crc, void* user);	// false to stop
+typedef bool (*ZZ_WALKDONE)(ZZ_WALKFOLDER* folder, void* user);
+
 // defined functions
-ZZ_FILE*		ZZ_fopen(const uint8_t* pathname, const uint8_t *mode);	// usual fopen letters
+ZZ_FILE*		ZZ_fopen(const uint8_t* pathname, const uint8_t *mode, uint32_t expect=0);	// usual fopen letters, expect=size if known
 ZZ_FILE*		ZZ_fopenD(ZZ_FILE* file, const uint8_t *mode);	// usual fopen letters
 void			ZZ_fclose(ZZ_FILE* fp);
 uint32_t		ZZ_fread(void* buffer, uint16_t count, ZZ_FILE* fp);
@@ -36,20 +64,24 @@ uint16_t		ZZ_fgetc(ZZ_FILE* fp);
 uint8_t*		ZZ_fgets(uint8_t* buffer, uint16_t count, ZZ_FILE* fp);
 int				ZZ_fputc(uint8_t c, ZZ_FILE* fp);
 int				ZZ_fputs(uint8_t* str, ZZ_FILE* fp);
+uint8_t			ZZ_fflush(ZZ_FILE* fp);						// 0=OK
 uint8_t			ZZ_fseek(ZZ_FILE* fp, int32_t offset, uint8_t origin); // 0=current, 1=end, 2=start
 uint32_t		ZZ_ftell(ZZ_FILE*fp);
 bool			ZZ_isDIR(ZZ_FILE* file);
 bool			ZZ_isFILE(ZZ_FILE* file);
 uint8_t			ZZ_isOpen(ZZ_FILE* file);
-const uint8_t*	ZZ_longpath(ZZ_FILE* fp);
-const uint8_t*	ZZ_longname(ZZ_FILE* fp);
+const uint8_t*	ZZ_longpath(ZZ_FILE* fp, uint8_t* buffer, uint16_t cb);	// copied into your buffer
+const uint8_t*	ZZ_longname(ZZ_FILE* fp, uint8_t* buffer, uint16_t cb);
 uint32_t		ZZ_filesize(ZZ_FILE* fp);
 
 ZZ_FOLDER*		ZZ_openfolder(const uint8_t* pathname);
 bool			ZZ_changefolder(ZZ_FOLDER* folder, const uint8_t* path);
 ZZ_FILE*		ZZ_findnextfile(ZZ_FOLDER* folder);
 void			ZZ_resetfolder(ZZ_FOLDER* folder);
-uint8_t*		ZZ_folderpathname(ZZ_FOLDER* fol);
+const uint8_t*	ZZ_folderpathname(ZZ_FOLDER* fol, uint8_t* buffer, uint16_t cb);
 void			ZZ_closefolder(ZZ_FOLDER* folder);
+uint16_t		ZZ_readfolder(ZZ_FOLDER* folder, ZZ_DIRENT* out, uint16_t max, uint8_t* names, uint16_t cbNames, uint8_t flags=0);
+ZZ_FILE*		ZZ_openentry(ZZ_FOLDER* folder, ZZ_DIRENT* entry);
+bool			ZZ_walk(const uint8_t* path, uint8_t flags, ZZ_WALKITEM onItem, ZZ_WALKDONE onFolder, void* user=nullptr, uint16_t nThreads=0);
 
-const char*		ZZ_writefiledesc(ZZ_FILE* fp);
+const char*		ZZ_writefiledesc(ZZ_FILE* fp, char* buffer, uint16_t cb);
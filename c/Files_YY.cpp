@@ -5,38 +5,90 @@
 #include <cstdio>
 #include <cstdint>
 #include <cassert>
+#include <cstring>
 #include <inttypes.h>		// see: https://en.cppreference.com/w/cpp/types/integer for printf'ing silly things
-#include <windows.h>
+#include "FAT_OS.h"		// <windows.h> or the bits of it we need
 
 #include "FAT_XX.h"
 #include "FAT_YY.h"
 
+static bool truncateFile(YY_FILE* file);
+static bool putBack(YY_FILE* file);
+static void trimChain(YY_FILE* file);
+static bool linkClusters(YY_FILE* file, uint32_t first, uint32_t n);
+
 //=================================================================================================
 // File slots
 //=================================================================================================
-#define MAX_FILES	100
-YY_FILE	files[MAX_FILES]{};
+static YY_POOL filePool{ sizeof(YY_FILE), YY_FILES_PER_ARENA };
+static YY_POOL ioPool{ sizeof(YY_FILEIO), YY_OPEN_PER_ARENA };
 
 YY_FILE* YY_GetFileSlot()
 {
-	for(int i=0; i<MAX_FILES; ++i)
-		if(files[i].drive == 0)
-			return &files[i];
-	return nullptr;
+	YY_FILE* file = (YY_FILE*)YY_PoolGet(&filePool);
+	if(file==nullptr){
+		printf("Out of file slots (%d in use)\n", filePool.used);
+		return nullptr;
+	}
+	*file = YY_FILE{};								// the last user's leavings and the free list link
+	return file;
+}
+// the open file part, kept if it's opened again
+static bool getIO(YY_FILE* file)
+{
+	if(file->io) return true;
+	file->io = (YY_FILEIO*)YY_PoolGet(&ioPool);
+	if(file->io==nullptr){
+		printf("Out of open file slots (%d in use)\n", ioPool.used);
+		return false;
+	}
+	*file->io = YY_FILEIO{};
+	return true;
+}
+static void freeIO(YY_FILE* file)
+{
+	YY_FILEIO* io = file->io;
+	if(io==nullptr) return;
+	putBack(file);									// the cache has what we wrote
+	if(io->extents) XX_free(io->extents);
+	YY_PoolPut(&ioPool, io);
+	file->io = nullptr;
 }
 void YY_FreeFileSlot(YY_FILE* file)
 {
-	if(file!=nullptr)
-		file->drive = 0;		// keep this as a routine as we might allocate stuff later
+	if(file!=nullptr){
+		freeIO(file);
+		if(file->longName) XX_free(file->longName);
+		file->longName	= nullptr;
+		YY_ReleasePath(file->path);
+		file->path		= nullptr;
+		file->open_mode	= 0;
+		file->drive		= 0;
+		YY_PoolPut(&filePool, file);
+	}
+}
+// a directory's path is shared by the items read from it and they may be on different threads
+static XX_LOCK pathLock = XX_LOCK_INIT;
+
+YY_PATH* YY_SharePath(YY_PATH* path)
+{
+	YY_Lock(&pathLock);
+	++path->refs;
+	YY_Unlock(&pathLock);
+	return path;
+}
+void YY_ReleasePath(YY_PATH* path)
+{
+	if(path==nullptr) return;
+	YY_Lock(&pathLock);
+	bool bLast = --path->refs==0;
+	YY_Unlock(&pathLock);
+	if(bLast) XX_free(path);
 }
 #if _DEBUG
 int UsedFileSlots()
 {
-	int n=0;
-	for(int i=0; i<MAX_FILES; ++i)
-		if(files[i].drive!=0)
-			++n;
-	return n;
+	return filePool.used;
 }
 #endif
 bool YY_isDIR(YY_FILE* file)
@@ -56,21 +108,38 @@ bool YY_matchName(YY_FILE* file, uint16_t* name)
 	uint16_t* p = file->longName;
 	for(int i=0; i<MAX_PATH; ++i){
 		if(p[i]==0 && name[i]==0) return true;
-		if(tolower(p[i])!=tolower(name[i])) return false;
+		if(YY_Fold(p[i])!=YY_Fold(name[i])) return false;
 	}
 	return false;
 }
-YY_FILE* YY_OpenFileDirect(YY_FILE* file, uint8_t mode)
+YY_FILE* YY_OpenFileDirect(YY_FILE* file, uint8_t mode, uint32_t expect)
 {
+	if((mode & FOM_WRITE) && (file->dirn.DIR_Attr & ATTR_RO)) return nullptr;
+	if(!getIO(file)) return nullptr;
 	file->open_mode = mode | FOM_OPEN;
-	file->sector_in_buffer_abs  = 0xffffffff;
-	file->sector_in_buffer_file = 0xffffffff;
-	file->first_sector = YY_ClusterToSector(file->drive, file->startCluster);
+	putBack(file);
+	file->io->file_dirty = false;
+	file->io->sector_in_buffer_abs  = 0xffffffff;
+	file->io->sector_in_buffer_file = 0xffffffff;
+	file->io->nExtents				= 0;			// build the map as we go
+	file->io->lastExtent			= 0;
+	file->io->extentsDone			= false;
+	file->io->readAhead				= 0;
+	file->io->readAheadEnd			= 0;
+	file->io->filePointer			= 0;
+	file->io->reserve				= YY_ALLOC_BATCH;
+	if(expect){									// they've told us how big it's going to be
+		uint32_t sectors = expect/512 + (expect%512 ? 1 : 0);
+		uint32_t n = (sectors + file->drive->sectors_in_cluster_mask) >> file->drive->sectors_to_cluster_right_slide;
+		if(n > file->io->reserve) file->io->reserve = n;
+	}
+	if((mode & (FOM_WRITE|FOM_CLEAN))==(FOM_WRITE|FOM_CLEAN) && !truncateFile(file))
+		return nullptr;
 	if((mode & (FOM_WRITE|FOM_APPEND))==(FOM_WRITE|FOM_APPEND))
-		file->filePointer = file->dirn.DIR_FileSize;
+		file->io->filePointer = file->dirn.DIR_FileSize;
 	return file;
 }
-YY_FILE* YY_OpenFile(uint16_t* pathname, uint8_t mode)
+YY_FILE* YY_OpenFile(uint16_t* pathname, uint8_t mode, uint32_t expect)
 {
 	// first we need to divide the file and the folder
 	int i;
@@ -83,26 +152,22 @@ YY_FILE* YY_OpenFile(uint16_t* pathname, uint8_t mode)
 	pathname[i] = save;									// restore the path
 	if(dir==nullptr) return nullptr;					// failed to find the folder
 
-	// now search the folder for the file
-	YY_FILE* file{};
-	while((file = YY_NextDirectoryItem(dir))!=nullptr){
-		if(YY_isFILE(file) && YY_matchName(file, &pathname[i])){
-			YY_CloseDirectory(dir);
-			return YY_OpenFileDirect(file, mode);
-		}
-		YY_CloseFile(file);
-	}
+	// now search the folder for the file and make it if we are allowed
+	YY_FILE* file = YY_FindDirectoryItem(dir, &pathname[i]);
+	if(file==nullptr && (mode & FOM_WRITE) && !(mode & FOM_MUSTEXIST))
+		file = YY_CreateItem(dir, &pathname[i], ATTR_ARCH);
 	YY_CloseDirectory(dir);
-	return nullptr;
+	if(file==nullptr) return nullptr;
+	if(!YY_isFILE(file) || YY_OpenFileDirect(file, mode, expect)==nullptr){
+		YY_FreeFileSlot(file);
+		return nullptr;
+	}
+	return file;
 }
 void YY_CloseFile(YY_FILE* file)
 {
-	// if we have written to the file
-	//		flush file stuff
-	//		update 'accessed' date/time
-	// if(we need to rewrite the directory entry...
-	//		re-find the directory sector as it might be changed
-	//		flush directory stuff
+	if(file->open_mode & FOM_WRITE)
+		YY_FlushFile(file);
 	YY_FreeFileSlot(file);
 }
 //-------------------------------------------------------------------------------------------------
@@ -112,94 +177,461 @@ bool YY_DeleteFile(YY_FILE*)
 {
 	return false;
 }
-bool YY_DeleteFile(uint8_t* pathname)
+bool YY_DeleteFile(uint8_t* /*pathname*/)
 {
 	return false;
 }
-uint64_t YY_SeekFile(YY_FILE* fp, uint64_t dest, uint8_t mode)
+// as the extent map finds any sector quickly all we do is move the file pointer
+bool YY_SeekFile(YY_FILE* file, uint32_t dest)
 {
-	return 0;
+	if(file->io==nullptr) return false;
+	if(dest > file->dirn.DIR_FileSize) return false;
+	file->io->filePointer = dest;
+	return true;
 }
-uint64_t YY_TellFile(YY_FILE*)
+uint32_t YY_TellFile(YY_FILE* file)
 {
-	return 0;
+	if(file->io==nullptr) return 0;
+	return file->io->filePointer;
 }
 //-------------------------------------------------------------------------------------------------
-// ReadBlock()		get the next 512byte block, returns bytes (1-512), 0=EOF, -ve error
+// Extent map
+// Rather than walk the FAT chain from the start every time we go backwards each open file keeps
+// a list of the runs of contiguous clusters it is made of. It is built as far as we have needed
+// to go and extended from the end when we need more so finding any sector in the file is then
+// a short search and not a FAT walk.
+// A file in more pieces than the map can hold (it is one XX_alloc()) gets a window on its chain:
+// when the map is full the first half goes and the runs at the tail are our place in the chain to
+// carry on from. Going back before the window starts it again from the first cluster.
 //-------------------------------------------------------------------------------------------------
-/*uint8_t	YY_ReadBlock(YY_FILE* file, void* buffer)
-{
-	if(file->dirn.DIR_FileSize <= file->filePointer)		// run out is run out
-		return 0;
-	uint32_t remains = file->dirn.DIR_FileSize - file->filePointer;
-	if(remains>512) remains = 512;
+#define MAX_EXTENTS		(0xffff/sizeof(YY_EXTENT))
 
-	if(!XX_ReadSector(file->drive->hDevice, file->sector, buffer)) return -1;
-	file->filePointer += remains;
-	file->sector = YY_GetNextSector(file->drive, file->sector);
-	return remains;
-}*/
-//-------------------------------------------------------------------------------------------------
-// WriteBlock()		write the next 512byte block, returns true on OK
-//-------------------------------------------------------------------------------------------------
-/*bool YY_WriteBlock(YY_FILE* file, void* buffer)
+static bool addExtent(YY_FILE* file, uint32_t fileCluster, uint32_t diskCluster)
+{
+	if(file->io->nExtents){
+		YY_EXTENT* e = &file->io->extents[file->io->nExtents-1];
+		if(e->diskCluster + e->length == diskCluster){		// just makes the last run longer
+			++e->length;
+			return true;
+		}
+	}
+	if(file->io->nExtents==file->io->maxExtents){					// need more room
+		uint16_t n = file->io->maxExtents ? file->io->maxExtents*2 : 4;
+		if(n > MAX_EXTENTS) n = MAX_EXTENTS;
+		YY_EXTENT* e = n>file->io->maxExtents ? (YY_EXTENT*)XX_alloc(n*sizeof(YY_EXTENT)) : nullptr;
+		if(e==nullptr){
+			if(file->io->nExtents<2) return false;
+			uint16_t drop = file->io->nExtents/2;					// slide the window along
+			file->io->nExtents -= drop;
+			memmove(file->io->extents, file->io->extents+drop, file->io->nExtents*sizeof(YY_EXTENT));
+			file->io->lastExtent = file->io->lastExtent>=drop ? file->io->lastExtent-drop : 0;
+			return addExtent(file, fileCluster, diskCluster);
+		}
+		if(file->io->extents){
+			memcpy(e, file->io->extents, file->io->nExtents*sizeof(YY_EXTENT));
+			XX_free(file->io->extents);
+		}
+		file->io->extents	 = e;
+		file->io->maxExtents = n;
+	}
+	YY_EXTENT* e = &file->io->extents[file->io->nExtents++];
+	e->fileCluster = fileCluster;
+	e->diskCluster = diskCluster;
+	e->length	   = 1;
+	return true;
+}
+// make sure the map reaches fileCluster, false if the chain doesn't go that far
+// the FAT lock is taken once for the whole walk and only if there is any walking to do
+static bool extendMap(YY_FILE* file, uint32_t fileCluster)
 {
-	// is this a 'first write' and we need a staring cluster?
-	if(file->sector==0){
-		uint32_t newCluster = YY_AllocateCluster(file->drive);
-		if(newCluster==0) return false;						// CAB
-		file->startCluster = newCluster;
-		file->sector = YY_ClusterToSector(file->drive, newCluster);
-		file->file_dirty = true;
+	if(file->io->nExtents && fileCluster < file->io->extents[0].fileCluster){
+		file->io->nExtents	  = 0;						// before the window so start again
+		file->io->lastExtent  = 0;
+		file->io->extentsDone = false;
 	}
-	else{
-		uint32_t sector = YY_GetNextSector(file->drive, file->sector);	// try and step through our cluster
-		if(sector==0){								// end of cluster
-			uint32_t newCluster = YY_AllocateCluster(file->drive);
-			if(newCluster==0) return false;
-			YY_SetClusterEntry(file->drive, YY_SectorToCluster(file->drive, file->sector), newCluster);
-			file->sector = YY_ClusterToSector(file->drive, newCluster);
+	YY_DRIVE* drive = file->drive;
+	bool bLocked = false, ret;
+	while(true){
+		uint32_t mapped = 0;				// clusters in the map
+		YY_EXTENT* e = nullptr;
+		if(file->io->nExtents){
+			e = &file->io->extents[file->io->nExtents-1];
+			mapped = e->fileCluster + e->length;
+		}
+		if(fileCluster < mapped){
+			ret = true;
+			break;
+		}
+		if(file->io->extentsDone){
+			ret = false;
+			break;
 		}
+		if(!bLocked){
+			YY_LockFat(drive);
+			bLocked = true;
+		}
+		uint32_t next;
+		if(e==nullptr)
+			next = file->startCluster;
 		else
-			file->sector = sector;
+			next = YY_GetClusterEntry(drive, e->diskCluster + e->length - 1, true);
+		if(YY_EndOfChain(drive, next) || !addExtent(file, mapped, next)){
+			file->io->extentsDone = true;
+			ret = false;
+			break;
+		}
+		// and take as much of the chain as runs on contiguously in one go
+		file->io->extents[file->io->nExtents-1].length += YY_ChainRun(drive, next, fileCluster-mapped, true);
+	}
+	if(bLocked) YY_UnlockFat(drive);
+	return ret;
+}
+// find the disk sector for a 'sector in file', returns 0 if the file isn't that big
+// if you give it run it says how many consecutive sectors on the disk start there
+static uint32_t findsector(YY_FILE* file, uint32_t required_sector_in_file, uint32_t* run=nullptr)
+{
+	YY_DRIVE* drive = file->drive;
+	uint32_t fileCluster = required_sector_in_file >> drive->sectors_to_cluster_right_slide;
+	if(!extendMap(file, fileCluster)) return 0;
+	if(run)											// map a bit further so the run can grow
+		extendMap(file, fileCluster + (XX_MAX_SECTORS >> drive->sectors_to_cluster_right_slide));
+
+	// try the run we used last time as we are usually sequential
+	YY_EXTENT* e = &file->io->extents[file->io->lastExtent];
+	if(fileCluster < e->fileCluster || fileCluster >= e->fileCluster + e->length){
+		uint16_t lo=0, hi=file->io->nExtents;	// binary chop
+		while(hi-lo>1){
+			uint16_t mid = (lo+hi)/2;
+			if(file->io->extents[mid].fileCluster <= fileCluster)
+				lo = mid;
+			else
+				hi = mid;
+		}
+		file->io->lastExtent = lo;
+		e = &file->io->extents[lo];
+	}
+	if(run)
+		*run = ((e->fileCluster + e->length) << drive->sectors_to_cluster_right_slide) - required_sector_in_file;
+	return YY_ClusterToSector(drive, e->diskCluster + fileCluster - e->fileCluster)
+				+ (required_sector_in_file & drive->sectors_in_cluster_mask);
+}
+// If we are reading in order get the next few sectors into the cache in one go rather than wait
+// on the device for each one. The window doubles each time we use it all up and collapses back to
+// nothing when we seek somewhere else.
+static void readahead(YY_FILE* file, uint32_t required_sector_in_file)
+{
+	if(required_sector_in_file!=file->io->sector_in_buffer_file+1){	// not sequential
+		file->io->readAhead	   = 0;
+		file->io->readAheadEnd = 0;
+		return;
 	}
+	if(required_sector_in_file < file->io->readAheadEnd)			// still using the last lot
+		return;
+	file->io->readAhead = file->io->readAhead==0 ? 2 : file->io->readAhead*2;
+	if(file->io->readAhead > YY_READAHEAD_MAX) file->io->readAhead = YY_READAHEAD_MAX;
 
-	if(!XX_WriteSector(file->drive->hDevice, file->sector, buffer)) return false;
-	file->sector = YY_GetNextSector(file->drive, file->sector);
+	uint32_t last = (file->dirn.DIR_FileSize+511)/512;			// don't go past the end
+	uint32_t run, n = file->io->readAhead;
+	if(n > last-required_sector_in_file) n = last-required_sector_in_file;
+	uint32_t abs_sector = findsector(file, required_sector_in_file, &run);
+	if(abs_sector==0) return;
+	if(n > run) n = run;										// only as far as it is contiguous
+	YY_PrefetchSectors(file->drive->hDevice, abs_sector, (uint16_t)n);
+	file->io->readAheadEnd = required_sector_in_file + n;
+}
+// Each open file works in its own copy of a sector. It comes from the cache (so it sees the
+// read-ahead and anything written) and goes back into it when we move on, flush or close so the
+// cache's blocks are only pinned for a moment and however many files are open none of them can
+// find it full. Two handles writing the same sector see each other's changes when they move on.
+static bool putBack(YY_FILE* file)
+{
+	if(!file->io->file_dirty) return true;
+	if(!YY_WriteSector(file->drive->hDevice, file->io->sector_in_buffer_abs, file->io->buffer))
+		return false;
+	file->io->file_dirty = false;
 	return true;
-}*/
-
+}
 // read a 'sector in file' into the buffer
-static uint8_t readsector(YY_FILE* file, uint32_t required_sector_in_file)
+// bRead=false if it is past the end of the file and there is nothing in it worth reading
+static uint8_t readsector(YY_FILE* file, uint32_t required_sector_in_file, bool bRead=true)
 {
-	uint32_t abs_sector  = file->first_sector;
-	uint32_t file_sector = 0;
-
-	// a quick short cut
-	if(required_sector_in_file > file->sector_in_buffer_file){
-		abs_sector  = file->sector_in_buffer_abs;
-		file_sector = file->sector_in_buffer_file;
-	}
-	// count up - normally this will be one call to next
-	while(file_sector<required_sector_in_file){
-		abs_sector = YY_GetNextSector(file->drive, abs_sector);
-		++file_sector;
-	}
-	if(!XX_ReadSector(file->drive->hDevice, abs_sector, file->buffer)) return 0;
-	file->sector_in_buffer_abs  = abs_sector;
-	file->sector_in_buffer_file = file_sector;
+	if(bRead) readahead(file, required_sector_in_file);
+	uint32_t abs_sector = findsector(file, required_sector_in_file);
+	if(!putBack(file)) return 0;									// the one we had
+	file->io->sector_in_buffer_file = 0xffffffff;
+	if(abs_sector==0) return 0;
+	if(!bRead)
+		memset(file->io->buffer, 0, 512);
+	else if(!YY_ReadSector(file->drive->hDevice, abs_sector, file->io->buffer))
+		return 0;
+	file->io->sector_in_buffer_abs  = abs_sector;
+	file->io->sector_in_buffer_file = required_sector_in_file;
 	return 1;
 }
 
 uint16_t YY_getc(YY_FILE* file)
 {
-	if(file->filePointer>= file->dirn.DIR_FileSize)
+	if(file->io==nullptr) return YY_EOF;
+	if(file->io->filePointer>= file->dirn.DIR_FileSize)
 		return YY_EOF;
-	uint16_t required_sector_in_file = file->filePointer/512;
-	if(required_sector_in_file != file->sector_in_buffer_file)
+	uint32_t required_sector_in_file = file->io->filePointer/512;
+	if(required_sector_in_file != file->io->sector_in_buffer_file)
 		if(readsector(file, required_sector_in_file) == 0)
 			return YY_EOF;
-	uint16_t index = file->filePointer % 512;
-	++file->filePointer;
-	return file->buffer[index];
+	uint16_t index = file->io->filePointer % 512;
+	++file->io->filePointer;
+	return file->io->buffer[index];
+}
+//-------------------------------------------------------------------------------------------------
+// ReadFile()	the bulk version of getc(), returns the number of bytes read
+// The ragged ends go through the sector buffer but whole sectors go straight from the device
+// into the caller's buffer without touching our buffer (or filling up the cache) and runs of
+// sectors that are consecutive on the disk go in one read
+//-------------------------------------------------------------------------------------------------
+uint32_t YY_ReadFile(YY_FILE* file, void* buffer, uint32_t count)
+{
+	uint8_t* out = (uint8_t*)buffer;
+	if(file->io==nullptr || file->io->filePointer >= file->dirn.DIR_FileSize)
+		return 0;
+	uint32_t remains = file->dirn.DIR_FileSize - file->io->filePointer;
+	if(count>remains) count = remains;
+
+	uint32_t done = 0;
+	while(done<count){
+		uint32_t required_sector_in_file = file->io->filePointer/512;
+		uint16_t index = file->io->filePointer % 512;
+		uint32_t n = count - done;
+		if(index==0 && n>=512 && required_sector_in_file!=file->io->sector_in_buffer_file){
+			// whole sectors to go straight into the output
+			uint32_t run;
+			uint32_t abs_sector = findsector(file, required_sector_in_file, &run);
+			if(run > n/512)			run = n/512;
+			if(run > XX_MAX_SECTORS) run = XX_MAX_SECTORS;
+			if(file->io->sector_in_buffer_file - required_sector_in_file < run && !putBack(file))
+				break;											// it's in the run so the cache needs what we wrote
+			if(abs_sector==0 || !YY_ReadSectors(file->drive->hDevice, abs_sector, run, out+done))
+				break;
+			n = run*512;
+		}
+		else{
+			// a part sector so use the buffer
+			if(required_sector_in_file != file->io->sector_in_buffer_file)
+				if(readsector(file, required_sector_in_file) == 0)
+					break;
+			if(n > 512u-index) n = 512-index;
+			memcpy(out+done, file->io->buffer+index, n);
+		}
+		done += n;
+		file->io->filePointer += n;
+	}
+	return done;
+}
+//-------------------------------------------------------------------------------------------------
+// Writing
+// Part sectors go through our sector buffer and whole sectors go straight from the
+// caller's buffer to the device in runs. The FAT and the directory entry are only changed in
+// memory until YY_FlushFile() or close.
+//
+// Space is reserved in contiguous runs so what we write comes out in one piece. The file first
+// tries to grow in place into the free clusters after its end, then asks for a run near there,
+// halving the size it asks for if there isn't one that long. Each time it grows the reservation
+// doubles (or starts at the size the opener said to expect) and on close anything past the end of
+// the file goes back.
+//-------------------------------------------------------------------------------------------------
+// make sure the file has clusters up to and including fileCluster
+static bool growChain(YY_FILE* file, uint32_t fileCluster)
+{
+	if(extendMap(file, fileCluster)) return true;
+	YY_DRIVE* drive = file->drive;
+	uint32_t mapped = 0, last = 0;
+	if(file->io->nExtents){
+		YY_EXTENT* e = &file->io->extents[file->io->nExtents-1];
+		mapped = e->fileCluster + e->length;
+		last   = e->diskCluster + e->length - 1;
+	}
+	uint32_t need = fileCluster+1 - mapped;
+	uint32_t want = need<file->io->reserve ? file->io->reserve : need;
+	if(file->io->reserve < YY_ALLOC_MAX){
+		file->io->reserve *= 2;
+		if(file->io->reserve > YY_ALLOC_MAX) file->io->reserve = YY_ALLOC_MAX;
+	}
+
+	if(last){									// grow in place if we can
+		uint32_t got = YY_ExtendChain(drive, last, want);
+		for(uint32_t i=0; i<got; ++i)
+			if(!addExtent(file, mapped+i, last+1+i)) return false;
+		if(got>=need) return true;
+		need -= got;
+		want -= got;
+		last += got;
+	}
+	while(need){								// then the longest runs we can find near us
+		uint32_t n = want, first;
+		while((first = YY_AllocateClusters(drive, n, last ? last+1 : 0))==0 && n>1)
+			n /= 2;
+		if(first==0 || !linkClusters(file, first, n)) return false;	// disk full
+		last = first+n-1;
+		want = want>n ? want-n : 0;
+		need = need>n ? need-n : 0;
+		if(want<need) want = need;
+	}
+	return true;
+}
+// hang a chain of n new contiguous clusters on the end of the file
+static bool linkClusters(YY_FILE* file, uint32_t first, uint32_t n)
+{
+	uint32_t mapped = 0;
+	if(file->io->nExtents){
+		YY_EXTENT* e = &file->io->extents[file->io->nExtents-1];
+		mapped = e->fileCluster + e->length;
+		YY_SetClusterEntry(file->drive, e->diskCluster + e->length - 1, first);
+	}
+	else{
+		file->startCluster		  = first;
+		file->dirn.DIR_FstClusHI = (uint16_t)(first>>16);
+		file->dirn.DIR_FstClusLO = (uint16_t)first;
+	}
+	file->open_mode |= FOM_DIRDIRTY;
+	for(uint32_t i=0; i<n; ++i)
+		if(!addExtent(file, mapped+i, first+i)) return false;
+	file->io->extentsDone = true;					// we know where the chain ends
+	return true;
+}
+// free the chain from a file cluster on
+// it follows the FAT rather than the map as the map may not reach back to it (or on to the end)
+static void freeFrom(YY_FILE* file, uint32_t fileCluster)
+{
+	YY_DRIVE* drive = file->drive;
+	uint32_t first;									// first cluster to go
+	if(fileCluster==0){
+		first = file->startCluster;
+		file->startCluster		  = 0;
+		file->dirn.DIR_FstClusHI = 0;
+		file->dirn.DIR_FstClusLO = 0;
+		file->open_mode |= FOM_DIRDIRTY;			// or the entry points at free clusters
+	}
+	else{
+		uint32_t sector = findsector(file, (fileCluster-1) << drive->sectors_to_cluster_right_slide);
+		if(sector==0) return;						// isn't that long
+		uint32_t last = YY_SectorToCluster(drive, sector);
+		first = YY_GetClusterEntry(drive, last, true);		// we're writing so the drive is ours
+		if(YY_EndOfChain(drive, first)) return;		// nothing after it
+		YY_SetClusterEntry(drive, last, 0x0fffffff);
+	}
+	YY_FreeChain(drive, first);
+
+	// and cut the map back to match
+	while(file->io->nExtents){
+		YY_EXTENT* e = &file->io->extents[file->io->nExtents-1];
+		if(e->fileCluster < fileCluster){
+			if(e->length > fileCluster-e->fileCluster) e->length = fileCluster-e->fileCluster;
+			break;
+		}
+		--file->io->nExtents;
+	}
+	if(file->io->lastExtent >= file->io->nExtents) file->io->lastExtent = 0;
+	file->io->extentsDone = file->io->nExtents!=0 || fileCluster==0;	// or start it again
+}
+// give back any clusters past the end of the file
+static void trimChain(YY_FILE* file)
+{
+	YY_DRIVE* drive = file->drive;
+	uint32_t keep = (file->dirn.DIR_FileSize + 511)/512;					// sectors
+	keep = (keep + drive->sectors_in_cluster_mask) >> drive->sectors_to_cluster_right_slide;	// clusters
+	freeFrom(file, keep);
+}
+// empty a file for "w" mode
+static bool truncateFile(YY_FILE* file)
+{
+	if(file->startCluster==0 && file->dirn.DIR_FileSize==0) return true;
+	freeFrom(file, 0);
+	file->dirn.DIR_FileSize = 0;
+	file->open_mode |= FOM_DIRDIRTY;
+	return true;
+}
+uint32_t YY_WriteFile(YY_FILE* file, const void* buffer, uint32_t count)
+{
+	if(!(file->open_mode & FOM_WRITE)) return 0;
+	if(file->open_mode & FOM_APPEND)
+		file->io->filePointer = file->dirn.DIR_FileSize;
+	if(count > 0xffffffff - file->io->filePointer)			// FAT files stop at 4G
+		count = 0xffffffff - file->io->filePointer;
+	YY_DRIVE* drive = file->drive;
+	const uint8_t* in = (const uint8_t*)buffer;
+
+	uint32_t done = 0;
+	while(done<count){
+		uint32_t required_sector_in_file = file->io->filePointer/512;
+		uint16_t index = file->io->filePointer % 512;
+		uint32_t n = count - done;
+		if(index==0 && n>=512 && required_sector_in_file!=file->io->sector_in_buffer_file){
+			// whole sectors go straight to the device, if the disk fills part way we write what it
+			// did get and return short
+			uint32_t last = required_sector_in_file + n/512 - 1;
+			growChain(file, last >> drive->sectors_to_cluster_right_slide);
+			uint32_t run;
+			uint32_t abs_sector = findsector(file, required_sector_in_file, &run);
+			if(run > n/512)			run = n/512;
+			if(run > XX_MAX_SECTORS) run = XX_MAX_SECTORS;
+			if(file->io->sector_in_buffer_file - required_sector_in_file < run){
+				file->io->file_dirty = false;					// our copy is being written over
+				file->io->sector_in_buffer_file = 0xffffffff;
+			}
+			if(abs_sector==0 || !YY_WriteSectors(drive->hDevice, abs_sector, run, in+done))
+				break;
+			n = run*512;
+		}
+		else{
+			// a part sector so use the buffer
+			if(required_sector_in_file != file->io->sector_in_buffer_file){
+				if(!growChain(file, required_sector_in_file >> drive->sectors_to_cluster_right_slide)) break;
+				bool bRead = required_sector_in_file*512 < file->dirn.DIR_FileSize;	// anything there to keep?
+				if(readsector(file, required_sector_in_file, bRead) == 0)
+					break;
+			}
+			if(n > 512u-index) n = 512-index;
+			memcpy(file->io->buffer+index, in+done, n);
+			file->io->file_dirty = true;
+		}
+		done += n;
+		file->io->filePointer += n;
+		if(file->io->filePointer > file->dirn.DIR_FileSize){
+			file->dirn.DIR_FileSize = file->io->filePointer;
+			file->open_mode |= FOM_DIRDIRTY;
+		}
+	}
+	if(done) file->open_mode |= FOM_DIRDIRTY;			// at least the time changes
+	return done;
+}
+bool YY_putc(YY_FILE* file, uint8_t c)
+{
+	// the common case of just another byte into the sector we have
+	if((file->open_mode & (FOM_WRITE|FOM_APPEND))==FOM_WRITE
+			&& file->io->filePointer/512==file->io->sector_in_buffer_file){
+		file->io->buffer[file->io->filePointer++ % 512] = c;
+		file->io->file_dirty = true;
+		if(file->io->filePointer > file->dirn.DIR_FileSize)
+			file->dirn.DIR_FileSize = file->io->filePointer;
+		file->open_mode |= FOM_DIRDIRTY;
+		return true;
+	}
+	return YY_WriteFile(file, &c, 1)==1;
+}
+// get everything we have written onto the device: data, FAT and directory entry
+// What we reserved and didn't use goes back too so the card is right if it's pulled out now.
+bool YY_FlushFile(YY_FILE* file)
+{
+	if(file->io==nullptr) return true;				// never opened so nothing to do
+	bool ret = putBack(file);								// let the cache have our sector
+	if(file->open_mode & FOM_WRITE)
+		trimChain(file);
+	if(file->open_mode & FOM_DIRDIRTY){
+		file->dirn.DIR_Attr |= ATTR_ARCH;
+		XX_GetDateTime(&file->dirn.DIR_WrtDate, &file->dirn.DIR_WrtTime);
+		file->dirn.DIR_LstAccDate = file->dirn.DIR_WrtDate;
+		ret = YY_UpdateItem(file) && ret;
+		file->open_mode &= ~FOM_DIRDIRTY;
+	}
+	YY_FlushFAT(file->drive);							// FAT, FSInfo and the cache
+	return ret;
 }
@@ -0,0 +1,259 @@
+//==========================================================================================================================
+//											MAKING A FILE SYSTEM
+//==========================================================================================================================
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <cctype>
+#include <cassert>
+#include <inttypes.h>
+#include "FAT_OS.h"		// <windows.h> or the bits of it we need
+
+#include "FAT_XX.h"
+#include "FAT_YY.h"
+
+//-------------------------------------------------------------------------------------------------
+// Lay down an empty FAT12/16/32 volume as the Microsoft specification has it: the boot sector
+// (and for FAT32 the FSInfo sector and backups of both), the FATs with their first entries set
+// and an empty root directory with the label in it. Nothing else is touched so on a new sparse
+// image (FMT_ZEROED) it is a dozen sector writes whatever the size. On a used device the rest of
+// the FATs and the root directory are zeroed too but the data area is left as it was.
+//-------------------------------------------------------------------------------------------------
+#define FLOPPY_SECTORS	2880			// 1.44M, the floppy we give floppy geometry to
+
+static bool putSector(HANDLE hDevice, uint32_t sector, const void* buffer)
+{
+	if(YY_WriteSectors(hDevice, sector, 1, buffer)) return true;
+	printf("Write failed at sector %" PRIu32 "\n", sector);
+	return false;
+}
+// count sectors of zeros, unless they are zeros already
+static bool putZeros(HANDLE hDevice, uint32_t sector, uint32_t count, uint8_t flags)
+{
+	if(count==0 || (flags & FMT_ZEROED)) return true;
+	uint8_t* zeros = (uint8_t*)XX_alloc(XX_MAX_SECTORS*512);
+	if(zeros==nullptr) return false;
+	memset(zeros, 0, XX_MAX_SECTORS*512);
+	bool ok = true;
+	while(ok && count){
+		uint16_t n = count>XX_MAX_SECTORS ? XX_MAX_SECTORS : (uint16_t)count;
+		ok = YY_WriteSectors(hDevice, sector, n, zeros);
+		if(!ok) printf("Write failed at sector %" PRIu32 "\n", sector);
+		sector += n;
+		count  -= n;
+	}
+	XX_free(zeros);
+	return ok;
+}
+// the default cluster sizes, from the Microsoft tables for FAT16 and FAT32
+static uint8_t clusterSize(uint8_t fatType, uint32_t nSectors)
+{
+	if(fatType==FAT12){
+		uint8_t spc = 1;
+		while(spc<128 && nSectors/spc>=4085) spc <<= 1;		// as small as keeps it FAT12
+		return spc;
+	}
+	if(fatType==FAT16)
+		return nSectors<=32680 ? 2 : nSectors<=262144 ? 4 : nSectors<=524288 ? 8 : nSectors<=1048576 ? 16
+			 : nSectors<=2097152 ? 32 : nSectors<=4194304 ? 64 : 128;
+	return nSectors<=532480 ? 1 : nSectors<=16777216 ? 8 : nSectors<=33554432 ? 16 : nSectors<=67108864 ? 32 : 64;
+}
+//-------------------------------------------------------------------------------------------------
+// Make a file system of fmt->nSectors starting at firstSector (0 or where its partition begins).
+// Anything in fmt left at zero is chosen from the size and filled in, as is what it came to.
+//-------------------------------------------------------------------------------------------------
+bool YY_Format(HANDLE hDevice, uint32_t firstSector, YY_FORMAT* fmt)
+{
+	assert(sizeof(FAT_VOL_ID)==512 && sizeof(FAT_FSINFO)==512 && sizeof(YY_DIRN)==32);
+
+	const char* names[] = { "?", "12", "16", "32" };
+	uint32_t total = fmt->nSectors;
+	bool bFloppy = total==FLOPPY_SECTORS;
+	if(fmt->fatType==UNKNOWN_FAT)
+		fmt->fatType = total<=8400 ? FAT12 : total<=1048576 ? FAT16 : FAT32;	// 4.1M and 512M
+	uint8_t type = fmt->fatType;
+	if(type>FAT32){
+		printf("There is no FAT type %u\n", type);
+		return false;
+	}
+	if(fmt->secPerClus==0)	fmt->secPerClus = clusterSize(type, total);
+	if(fmt->nFats==0)		fmt->nFats = 2;
+	if(type==FAT32)			fmt->rootEntries = 0;
+	else if(fmt->rootEntries==0)
+		fmt->rootEntries = bFloppy ? 224 : 512;
+	uint8_t spc = fmt->secPerClus;
+	if((spc & (spc-1))!=0){
+		printf("Sectors per cluster must be a power of two\n");
+		return false;
+	}
+	uint16_t rsvd = type==FAT32 ? 32 : 1;
+	uint32_t rootSecs = ((uint32_t)fmt->rootEntries*32 + 511)/512;
+	fmt->rootEntries = (uint16_t)(rootSecs*16);		// no point leaving part of a sector unused
+
+	// The FATs must cover the clusters left after them so go round until they do. Each time round
+	// they can only get bigger and the clusters fewer so it soon settles.
+	uint32_t fatSize = 1, nClusters;
+	for(;;){
+		uint32_t system = rsvd + fmt->nFats*fatSize + rootSecs;
+		if(system+spc > total){
+			printf("%" PRIu32 " sectors is too small for FAT%s\n", total, names[type]);
+			return false;
+		}
+		nClusters = (total-system)/spc;
+		uint32_t bytes = type==FAT12 ? ((nClusters+2)*3+1)/2 : (nClusters+2)*(type==FAT16 ? 2 : 4);
+		uint32_t need = (bytes+511)/512;
+		if(need<=fatSize) break;
+		fatSize = need;
+	}
+	// the type is decided by the cluster count when it's mounted so it has to come out right
+	uint32_t lo = type==FAT12 ? 1 : type==FAT16 ? 4085 : 65525;
+	uint32_t hi = type==FAT12 ? 4084 : type==FAT16 ? 65524 : 0x0ffffff4;
+	if(nClusters<lo || nClusters>hi){
+		printf("%" PRIu32 " clusters of %u sectors won't do for FAT%s, try another cluster size\n", nClusters, spc, names[type]);
+		return false;
+	}
+	fmt->nClusters	= nClusters;
+	fmt->fatSize	= fatSize;
+	fmt->dataSector	= rsvd + fmt->nFats*fatSize + rootSecs;
+
+	uint16_t date, time;
+	XX_GetDateTime(&date, &time);
+	if(fmt->volID==0) fmt->volID = ((uint32_t)date<<16) | time;
+	uint8_t label[11];
+	memset(label, ' ', sizeof label);
+	for(int i=0; i<11 && fmt->label[i]; ++i)
+		label[i] = (uint8_t)toupper((uint8_t)fmt->label[i]);
+	uint8_t media = bFloppy ? 0xf0 : 0xf8;
+
+	uint8_t* buffer = (uint8_t*)XX_alloc(512);		// each sector we make in turn
+	if(buffer==nullptr) return false;
+	bool ok = putZeros(hDevice, firstSector, rsvd, fmt->flags);
+
+	// boot sector
+	FAT_VOL_ID* v = (FAT_VOL_ID*)buffer;
+	memset(v, 0, 512);
+	v->BS_jmpBoot[0]	= 0xeb;
+	v->BS_jmpBoot[1]	= type==FAT32 ? 0x58 : 0x3c;	// over the BPB
+	v->BS_jmpBoot[2]	= 0x90;
+	memcpy(v->BS_OEMName, "MSDOS5.0", 8);				// what ReadBootSector() takes as "no partition table"
+	v->BPB_BytsPerSec	= 512;
+	v->BPB_SecPerClus	= spc;
+	v->BPB_RsvdSecCnt	= rsvd;
+	v->BPB_NumFATs		= fmt->nFats;
+	v->BPB_RootEntCnt	= fmt->rootEntries;
+	if(type!=FAT32 && total<0x10000)
+		v->BPB_TotSec16	= (uint16_t)total;
+	else
+		v->BPB_TotSec32	= total;
+	v->BPB_Media		= media;
+	v->BPB_SecPerTrk	= bFloppy ? 18 : 63;
+	v->BPB_NumHeads		= bFloppy ? 2 : 255;
+	v->BPB_HiddSec		= firstSector;
+	if(type==FAT32){
+		v->BPB_FATSz32		= fatSize;
+		v->BPB_RootClus		= 2;
+		v->BPB_FSInfo		= 1;
+		v->BPB_BkBootSec	= 6;
+		v->BS_DrvNum32		= 0x80;
+		v->BS_BootSig32		= 0x29;
+		v->BS_VolID32		= fmt->volID;
+		memcpy(v->BS_VolLab32, fmt->label[0] ? label : (const uint8_t*)"NO NAME    ", 11);
+		memcpy(v->BS_FilSysType32, "FAT32   ", 8);
+	}
+	else{
+		v->BPB_FATSz16		= (uint16_t)fatSize;
+		v->BS_DrvNum		= bFloppy ? 0x00 : 0x80;
+		v->BS_BootSig		= 0x29;
+		v->BS_VolID			= fmt->volID;
+		memcpy(v->BS_VolLab, fmt->label[0] ? label : (const uint8_t*)"NO NAME    ", 11);
+		memcpy(v->BS_FilSysType, type==FAT12 ? "FAT12   " : "FAT16   ", 8);
+	}
+	v->sig1 = 0x55;
+	v->sig2 = 0xaa;
+	ok = ok && putSector(hDevice, firstSector, v);
+	if(type==FAT32){
+		ok = ok && putSector(hDevice, firstSector+6, v);		// the backup
+
+		FAT_FSINFO* fsi = (FAT_FSINFO*)buffer;
+		memset(fsi, 0, 512);
+		fsi->FSI_LeadSig	= 0x41615252;
+		fsi->FSI_StrucSig	= 0x61417272;
+		fsi->FSI_Free_Count	= nClusters-1;					// all but the root directory
+		fsi->FSI_Nxt_Free	= 3;
+		fsi->FSI_TrailSig	= 0xaa550000;
+		ok = ok && putSector(hDevice, firstSector+1, fsi) && putSector(hDevice, firstSector+7, fsi);
+	}
+
+	// the FATs, entry 0 is the media byte, 1 is end of chain and on FAT32 so is the root's cluster 2
+	memset(buffer, 0, 512);
+	if(type==FAT12){
+		buffer[0] = media;
+		buffer[1] = buffer[2] = 0xff;
+	}
+	else if(type==FAT16){
+		((uint16_t*)buffer)[0] = 0xff00 | media;
+		((uint16_t*)buffer)[1] = 0xffff;
+	}
+	else{
+		((uint32_t*)buffer)[0] = 0x0fffff00 | media;
+		((uint32_t*)buffer)[1] = 0x0fffffff;
+		((uint32_t*)buffer)[2] = 0x0fffffff;
+	}
+	for(uint8_t i=0; ok && i<fmt->nFats; ++i){
+		uint32_t fat = firstSector + rsvd + i*fatSize;
+		ok = putSector(hDevice, fat, buffer) && putZeros(hDevice, fat+1, fatSize-1, fmt->flags);
+	}
+
+	// the root directory, the fixed one after the FATs or cluster 2, with the label in it
+	uint32_t root = firstSector + rsvd + fmt->nFats*fatSize;
+	uint32_t rootCount = type==FAT32 ? spc : rootSecs;
+	memset(buffer, 0, 512);
+	if(fmt->label[0]){
+		YY_DIRN* d = (YY_DIRN*)buffer;
+		memcpy(d->DIR_Name, label, 8);
+		memcpy(d->DIR_Ext, label+8, 3);
+		d->DIR_Attr		= ATTR_VOL;
+		d->DIR_WrtDate	= date;
+		d->DIR_WrtTime	= time;
+	}
+	ok = ok && putSector(hDevice, root, buffer) && putZeros(hDevice, root+1, rootCount-1, fmt->flags);
+	XX_free(buffer);
+
+	return XX_FlushDevice(hDevice) && ok;
+}
+//-------------------------------------------------------------------------------------------------
+// The partition table type for a volume YY_Format() has made
+//-------------------------------------------------------------------------------------------------
+uint8_t YY_PartitionType(uint8_t fatType, uint32_t nSectors)
+{
+	if(fatType==FAT12) return 0x01;
+	if(fatType==FAT16) return nSectors<0x10000 ? 0x04 : 0x06;	// FAT16 and FAT16B
+	return 0x0c;												// FAT32 LBA
+}
+//-------------------------------------------------------------------------------------------------
+// Write sector 0 as a partition table of up to four entries. Only LBA_Begin, nSectors and
+// Type_Code need filling in, the CHS fields get the "go by the LBA" values.
+//-------------------------------------------------------------------------------------------------
+bool YY_WritePartitions(HANDLE hDevice, BOOT_SECTOR::PARTITION* table, uint8_t n)
+{
+	assert(sizeof(BOOT_SECTOR)==512);
+
+	if(n>4) return false;
+	BOOT_SECTOR* mbr = (BOOT_SECTOR*)XX_alloc(sizeof(BOOT_SECTOR));
+	if(mbr==nullptr) return false;
+	memset(mbr, 0, sizeof(BOOT_SECTOR));
+	for(uint8_t i=0; i<n; ++i){
+		BOOT_SECTOR::PARTITION* p = &mbr->Partitions[i];
+		p->Type_Code = table[i].Type_Code;
+		p->LBA_Begin = table[i].LBA_Begin;
+		p->nSectors	 = table[i].nSectors;
+		p->CHS_Begin.set(0xfffffe);
+		p->CHS_End.set(0xfffffe);
+	}
+	mbr->sig1 = 0x55;
+	mbr->sig2 = 0xaa;
+	bool ok = putSector(hDevice, 0, mbr);
+	XX_free(mbr);
+	return XX_FlushDevice(hDevice) && ok;
+}
@@ -0,0 +1,95 @@
+//==========================================================================================================================
+//											FIXED SIZE ITEM POOLS
+//==========================================================================================================================
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <cassert>
+#include "FAT_OS.h"		// <windows.h> or the bits of it we need
+
+#include "FAT_XX.h"
+#include "FAT_YY.h"
+
+//-------------------------------------------------------------------------------------------------
+// Files, directories and handles used to live in fixed arrays that got searched from the start for
+// a free slot. Now each kind has a pool: a free list threaded through the unused items so getting
+// and putting one is O(1), and arenas of perArena items that are only allocated when the free list
+// runs dry. Arenas are never given back (they're small and we'll want them again) so an item's
+// address and index stay good for the life of the program, which the ZZ_ handles rely on.
+// New arenas are zeroed so anything kept in an item beyond the free list link starts at zero.
+// All the pools share one lock as nothing is done while holding it but shuffle a pointer or two.
+//-------------------------------------------------------------------------------------------------
+static XX_LOCK poolLock = XX_LOCK_INIT;
+
+static bool growPool(YY_POOL* pool)
+{
+	if(pool->nArenas>=YY_POOL_ARENAS) return false;
+	// everything is pack(1) so sizeof() can be odd, round it up so every item can hold the link
+	if(pool->nArenas==0)
+		pool->size = (uint16_t)((pool->size + alignof(void*)-1) & ~(alignof(void*)-1));
+	assert(pool->size>=sizeof(void*));
+	uint32_t nBytes = (uint32_t)pool->size * pool->perArena;
+	assert(nBytes<=0xffff);								// XX_alloc() only does 64K
+	uint8_t* arena = (uint8_t*)XX_alloc((uint16_t)nBytes);
+	if(arena==nullptr) return false;
+	memset(arena, 0, nBytes);
+	pool->arenas[pool->nArenas++] = arena;
+
+	// thread them onto the free list so the first in the arena comes out first
+	for(uint16_t i=pool->perArena; i>0; --i){
+		uint8_t* item = arena + (uint32_t)(i-1)*pool->size;
+		*(void**)item = pool->freeList;
+		pool->freeList = item;
+	}
+	return true;
+}
+void* YY_PoolGet(YY_POOL* pool)
+{
+	YY_Lock(&poolLock);
+	if(pool->freeList==nullptr && !growPool(pool)){
+		YY_Unlock(&poolLock);
+		return nullptr;
+	}
+	void* item = pool->freeList;
+	pool->freeList = *(void**)item;
+	*(void**)item = nullptr;
+	if(++pool->used>pool->peak) pool->peak = pool->used;
+	YY_Unlock(&poolLock);
+	return item;
+}
+void YY_PoolPut(YY_POOL* pool, void* item)
+{
+	if(item==nullptr) return;
+	YY_Lock(&poolLock);
+	*(void**)item = pool->freeList;
+	pool->freeList = item;
+	--pool->used;
+	YY_Unlock(&poolLock);
+}
+// items are numbered 0.. in arena order so handles can be small numbers rather than pointers
+void* YY_PoolItem(YY_POOL* pool, uint16_t index)
+{
+	uint16_t arena = index / pool->perArena;
+	void* item = nullptr;
+	YY_Lock(&poolLock, true);
+	if(arena<pool->nArenas)
+		item = pool->arenas[arena] + (uint32_t)(index % pool->perArena)*pool->size;
+	YY_Unlock(&poolLock, true);
+	return item;
+}
+uint16_t YY_PoolIndex(YY_POOL* pool, void* item)
+{
+	uint32_t span = (uint32_t)pool->size * pool->perArena;
+	uint16_t index = 0xffff;
+	YY_Lock(&poolLock, true);
+	for(uint8_t i=0; i<pool->nArenas; ++i){
+		uint8_t* a = pool->arenas[i];
+		if((uint8_t*)item>=a && (uint8_t*)item<a+span){
+			index = (uint16_t)(i*pool->perArena + ((uint8_t*)item-a)/pool->size);
+			break;
+		}
+	}
+	YY_Unlock(&poolLock, true);
+	return index;
+}
@@ -0,0 +1,410 @@
+//==============================================================================================================
+//			THE XX_ DEVICE LAYER FOR LINUX AND OTHER POSIX SYSTEMS
+//==============================================================================================================
+
+// This is the POSIX equivalent of the Windows interface section of FAT.cpp so link one or the other.
+// It works on raw block devices (/dev/sdb) and on disk image files alike. All transfers use the
+// positional pread()/pwrite() calls so there is no separate seek and nothing shared to go wrong.
+//
+// Opening with XX_DIRECT asks for O_DIRECT to keep the host page cache out of the way when soak
+// testing real cards. O_DIRECT wants aligned buffers, offsets and lengths so anything that isn't
+// aligned goes through a bounce buffer. Our transfers are 512 byte sectors so a device with bigger
+// logical sectors (or an image on one) can't do it at all, nor can some file systems, and then we
+// just open it normally and say so.
+//
+// Opening with XX_MAPPED memory maps the whole device or image (shared, so it is the host's page
+// cache we are looking at) and XX_MapSector() hands out pointers to the sectors in it. The cache
+// lends those to the YY layer instead of copying into its blocks so walking directories and
+// reading files costs no copies and no system calls. Writes land in the map and get to the disk
+// when the host feels like it or on XX_FlushDevice().
+
+#if !defined(_WIN32)
+
+#if !defined(_GNU_SOURCE)
+#define _GNU_SOURCE			// for O_DIRECT
+#endif
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <ctime>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <sched.h>
+#if defined(__linux__)
+#include <linux/fs.h>		// BLKSSZGET
+#endif
+
+#include "FAT_OS.h"
+#include "FAT_XX.h"
+
+bool bVerbose = true;				// make then UI chatty
+
+#define DIRECT_ALIGN	4096		// bounce buffer alignment, enough for any logical sector size
+
+static XX_LOCK bounceLock = XX_LOCK_INIT;	// one O_DIRECT transfer through a bounce buffer at a time
+
+struct XX_DEVICE {
+	int			fd;					// the open device or image
+	uint8_t		flags;				// XX_DIRECT et al.
+	uint8_t*	bounce;				// aligned XX_MAX_SECTORS buffer if O_DIRECT, nullptr if not
+	uint8_t*	map;				// the whole thing if XX_MAPPED, nullptr if not
+	uint64_t	cbMap;				// bytes mapped
+};
+
+//-------------------------------------------------------------------------------------------------
+// errno into readable text
+//-------------------------------------------------------------------------------------------------
+void error()
+{
+	int err = errno;
+	printf("Error %d: %s\n", err, strerror(err));
+}
+//-------------------------------------------------------------------------------------------------
+// Dump bytes in the usual bytes/chars format
+//-------------------------------------------------------------------------------------------------
+void dump(void* buffer, int cb)
+{
+	uint8_t *buf = (uint8_t*)buffer;
+	for(int i=0; i<cb; i+=16){
+		int n = cb-i, j;
+		if(n>16) n=16;
+		printf("%04X ", i);
+		for(j=0; j<n; j++)
+			printf("%02X ", buf[i+j]);
+		for( ;j<16; j++)
+			printf("   ");
+		printf("   ");
+		for(j=0; j<n; j++){
+			uint8_t c= buf[i+j];
+			if(c<0x20 || c>=0x7f) c = ' ';
+			printf("%c ", c);
+		}
+		printf("\n");
+	}
+}
+//-------------------------------------------------------------------------------------------------
+// Open the target device or image
+//-------------------------------------------------------------------------------------------------
+#if defined(O_DIRECT)
+// Can an O_DIRECT handle do 512 byte transfers? Ask a block device its logical sector size and
+// try reading a sector of anything else as EINVAL on a read is all an image file will tell us.
+static bool direct512(int fd)
+{
+	struct stat st;
+	if(fstat(fd, &st)!=0) return false;
+	if(S_ISBLK(st.st_mode)){
+#if defined(BLKSSZGET)
+		int cb = 0;
+		return ioctl(fd, BLKSSZGET, &cb)==0 && cb==512;
+#else
+		return false;
+#endif
+	}
+	void* p;
+	if(posix_memalign(&p, DIRECT_ALIGN, 512)!=0) return false;
+	bool ok = pread(fd, p, 512, 512)>=0 || errno!=EINVAL;
+	free(p);
+	return ok;
+}
+#endif
+HANDLE XX_OpenDevice(const char* nameDevice, uint8_t flags)
+{
+	int fd = -1;
+#if defined(O_DIRECT)
+	if(flags & XX_DIRECT){
+		fd = open(nameDevice, O_RDWR | O_DIRECT);
+		if(fd<0 && errno==EINVAL){		// tmpfs and friends
+			printf("O_DIRECT not supported on %s, using buffered IO\n", nameDevice);
+			flags &= ~XX_DIRECT;
+		}
+		else if(fd>=0 && !direct512(fd)){	// 4K sectors
+			printf("O_DIRECT can't do 512 byte sectors on %s, using buffered IO\n", nameDevice);
+			close(fd);
+			fd = -1;
+			flags &= ~XX_DIRECT;
+		}
+	}
+	else
+#endif
+		flags &= ~XX_DIRECT;
+	if(fd<0)
+		fd = open(nameDevice, O_RDWR);
+	if(fd<0)
+		return INVALID_HANDLE_VALUE;
+
+	XX_DEVICE* dev = new XX_DEVICE{ fd, flags, nullptr, nullptr, 0 };
+	if(flags & XX_MAPPED){
+		off_t cb = lseek(fd, 0, SEEK_END);	// st_size is zero for block devices, this isn't
+		void* p = cb>0 ? mmap(nullptr, (size_t)cb, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+		if(p==MAP_FAILED){
+			printf("Can't map %s, using pread/pwrite\n", nameDevice);
+			dev->flags = flags &= ~XX_MAPPED;
+		}
+		else{
+			dev->map   = (uint8_t*)p;
+			dev->cbMap = (uint64_t)cb;
+			dev->flags = flags &= ~XX_DIRECT;	// no IO so nothing to bypass
+		}
+	}
+	if(flags & XX_DIRECT){
+		void* p;
+		if(posix_memalign(&p, DIRECT_ALIGN, XX_MAX_SECTORS*512)!=0){
+			close(fd);
+			delete dev;
+			return INVALID_HANDLE_VALUE;
+		}
+		dev->bounce = (uint8_t*)p;
+	}
+	printf("Opened device OK:  %s%s\n", nameDevice,
+				(flags & XX_DIRECT) ? " (O_DIRECT)" : (flags & XX_MAPPED) ? " (mapped)" : "");
+	return (HANDLE)dev;
+}
+void XX_CloseDevice(HANDLE hDevice)
+{
+	XX_DEVICE* dev = (XX_DEVICE*)hDevice;
+	if(dev->map)	munmap(dev->map, (size_t)dev->cbMap);
+	if(dev->bounce) free(dev->bounce);
+	close(dev->fd);
+	delete dev;
+}
+//-------------------------------------------------------------------------------------------------
+// Make an image file nSectors long. It is sparse so it costs nothing until it's written.
+//-------------------------------------------------------------------------------------------------
+bool XX_CreateImage(const char* name, uint32_t nSectors)
+{
+	int fd = open(name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if(fd<0) return false;
+	bool ok = ftruncate(fd, (off_t)nSectors*512)==0;
+	close(fd);
+	return ok;
+}
+uint32_t XX_DeviceSectors(HANDLE hDevice)
+{
+	XX_DEVICE* dev = (XX_DEVICE*)hDevice;
+	off_t cb = lseek(dev->fd, 0, SEEK_END);		// works for block devices too, we only use pread/pwrite
+	if(cb<=0) return 0;
+	return (uint64_t)cb/512 > 0xffffffff ? 0xffffffff : (uint32_t)(cb/512);
+}
+//-------------------------------------------------------------------------------------------------
+// Move cb bytes at a byte offset. pread()/pwrite() are allowed to do less than asked so keep going
+//-------------------------------------------------------------------------------------------------
+static bool transfer(XX_DEVICE* dev, bool bWrite, uint64_t offset, uint8_t* buffer, uint32_t cb)
+{
+	if(dev->map){
+		if(offset+cb > dev->cbMap) return false;
+		if(bWrite) memcpy(dev->map+offset, buffer, cb);
+		else	   memcpy(buffer, dev->map+offset, cb);
+		return true;
+	}
+	while(cb){
+		ssize_t n = bWrite ? pwrite(dev->fd, buffer, cb, (off_t)offset)
+						   : pread(dev->fd, buffer, cb, (off_t)offset);
+		if(n<0 && errno==EINTR) continue;
+		if(n<=0) return false;			// error or off the end of the device
+		buffer += n;
+		offset += n;
+		cb	   -= (uint32_t)n;
+	}
+	return true;
+}
+static bool aligned(XX_DEVICE* dev, void* buffer)
+{
+	return dev->bounce==nullptr || ((uintptr_t)buffer % DIRECT_ALIGN)==0;
+}
+// consecutive sectors into/out of one buffer, via the bounce buffer if O_DIRECT won't take it
+static bool sectors(HANDLE hDevice, bool bWrite, uint32_t sector, uint16_t count, void* buffer)
+{
+	XX_DEVICE* dev = (XX_DEVICE*)hDevice;
+	if(aligned(dev, buffer))
+		return transfer(dev, bWrite, (uint64_t)sector*512, (uint8_t*)buffer, count*512);
+
+	uint8_t* buf = (uint8_t*)buffer;
+	bool ret = true;
+	XX_Lock(&bounceLock);
+	while(ret && count){
+		uint16_t n = count>XX_MAX_SECTORS ? XX_MAX_SECTORS : count;
+		if(bWrite) memcpy(dev->bounce, buf, n*512);
+		ret = transfer(dev, bWrite, (uint64_t)sector*512, dev->bounce, n*512);
+		if(ret && !bWrite) memcpy(buf, dev->bounce, n*512);
+		buf	   += n*512;
+		sector += n;
+		count  -= n;
+	}
+	XX_Unlock(&bounceLock);
+	return ret;
+}
+//-------------------------------------------------------------------------------------------------
+// Read/Write a sector
+//-------------------------------------------------------------------------------------------------
+bool XX_ReadSector(HANDLE hDevice, uint32_t sector, void* buffer)
+{
+	return sectors(hDevice, false, sector, 1, buffer);
+}
+bool XX_WriteSector(HANDLE hDevice, uint32_t sector, void* buffer)
+{
+	return sectors(hDevice, true, sector, 1, buffer);
+}
+//-------------------------------------------------------------------------------------------------
+// Read/Write a run of consecutive sectors in one go
+//-------------------------------------------------------------------------------------------------
+bool XX_ReadSectors(HANDLE hDevice, uint32_t sector, uint16_t count, void* buffer)
+{
+	return sectors(hDevice, false, sector, count, buffer);
+}
+bool XX_WriteSectors(HANDLE hDevice, uint32_t sector, uint16_t count, void* buffer)
+{
+	return sectors(hDevice, true, sector, count, buffer);
+}
+//-------------------------------------------------------------------------------------------------
+// Scatter/gather versions where each sector has its own buffer
+// preadv()/pwritev() do it in one call. If that comes up short finish off a sector at a time.
+//-------------------------------------------------------------------------------------------------
+static bool sectorsV(HANDLE hDevice, bool bWrite, uint32_t sector, uint16_t count, void** buffers)
+{
+	if(count>XX_MAX_SECTORS) return false;
+	XX_DEVICE* dev = (XX_DEVICE*)hDevice;
+
+	if(dev->map){
+		for(uint16_t i=0; i<count; ++i)
+			if(!transfer(dev, bWrite, (uint64_t)(sector+i)*512, (uint8_t*)buffers[i], 512)) return false;
+		return true;
+	}
+	bool bAligned = true;
+	for(uint16_t i=0; i<count; ++i)
+		if(!aligned(dev, buffers[i])) bAligned = false;
+	if(!bAligned){						// O_DIRECT and the cache's buffers aren't aligned
+		XX_Lock(&bounceLock);
+		if(bWrite)
+			for(uint16_t i=0; i<count; ++i)
+				memcpy(dev->bounce+i*512, buffers[i], 512);
+		bool ret = transfer(dev, bWrite, (uint64_t)sector*512, dev->bounce, count*512);
+		if(ret && !bWrite)
+			for(uint16_t i=0; i<count; ++i)
+				memcpy(buffers[i], dev->bounce+i*512, 512);
+		XX_Unlock(&bounceLock);
+		return ret;
+	}
+
+	struct iovec iov[XX_MAX_SECTORS];
+	for(uint16_t i=0; i<count; ++i){
+		iov[i].iov_base = buffers[i];
+		iov[i].iov_len	= 512;
+	}
+	ssize_t n;
+	do
+		n = bWrite ? pwritev(dev->fd, iov, count, (off_t)sector*512)
+				   : preadv(dev->fd, iov, count, (off_t)sector*512);
+	while(n<0 && errno==EINTR);
+	if(n<0) return false;
+
+	uint32_t done = (uint32_t)n;
+	for(uint16_t i=done/512; i<count; ++i){
+		uint32_t skip = i==done/512 ? done%512 : 0;
+		if(!transfer(dev, bWrite, (uint64_t)(sector+i)*512+skip, (uint8_t*)buffers[i]+skip, 512-skip))
+			return false;
+	}
+	return true;
+}
+bool XX_ReadSectorsV(HANDLE hDevice, uint32_t sector, uint16_t count, void** buffers)
+{
+	return sectorsV(hDevice, false, sector, count, buffers);
+}
+bool XX_WriteSectorsV(HANDLE hDevice, uint32_t sector, uint16_t count, void** buffers)
+{
+	return sectorsV(hDevice, true, sector, count, buffers);
+}
+//-------------------------------------------------------------------------------------------------
+// Lend out a sector of a mapped device, nullptr if it isn't mapped (or is too small)
+//-------------------------------------------------------------------------------------------------
+uint8_t* XX_MapSector(HANDLE hDevice, uint32_t sector)
+{
+	XX_DEVICE* dev = (XX_DEVICE*)hDevice;
+	if(dev->map==nullptr || ((uint64_t)sector+1)*512 > dev->cbMap) return nullptr;
+	return dev->map + (uint64_t)sector*512;
+}
+bool XX_FlushDevice(HANDLE hDevice)
+{
+	XX_DEVICE* dev = (XX_DEVICE*)hDevice;
+	if(dev->map)
+		return msync(dev->map, (size_t)dev->cbMap, MS_SYNC)==0;
+	return true;
+}
+//-------------------------------------------------------------------------------------------------
+// The time now packed as a directory entry wants it
+//-------------------------------------------------------------------------------------------------
+void XX_GetDateTime(uint16_t* date, uint16_t* time)
+{
+	time_t now = ::time(nullptr);
+	struct tm t;
+	localtime_r(&now, &t);
+	*date = (uint16_t)(((t.tm_year-80)<<9) | ((t.tm_mon+1)<<5) | t.tm_mday);
+	*time = (uint16_t)((t.tm_hour<<11) | (t.tm_min<<5) | (t.tm_sec/2));
+}
+//-------------------------------------------------------------------------------------------------
+// Memory management functions
+//-------------------------------------------------------------------------------------------------
+void* XX_alloc(uint16_t nbytes)
+{
+	return new uint8_t[nbytes];
+}
+void XX_free(void* item)
+{
+	delete[] (uint8_t*)item;
+}
+//-------------------------------------------------------------------------------------------------
+// Locks, pthread reader/writer locks so they can be set up statically with XX_LOCK_INIT
+//-------------------------------------------------------------------------------------------------
+void XX_Lock(XX_LOCK* lock, bool bShared)
+{
+	if(bShared) pthread_rwlock_rdlock(lock);
+	else		pthread_rwlock_wrlock(lock);
+}
+void XX_Unlock(XX_LOCK* lock, bool /*bShared*/)
+{
+	pthread_rwlock_unlock(lock);
+}
+void XX_Yield()
+{
+	sched_yield();
+}
+//-------------------------------------------------------------------------------------------------
+// Threads: work(args[0]) runs on the caller and the rest get a thread each. Any that can't have
+// one run on the caller too so they all get done whatever. Returns when they have all finished.
+//-------------------------------------------------------------------------------------------------
+uint16_t XX_Cores()
+{
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	return n<1 ? 1 : n>0xffff ? 0xffff : (uint16_t)n;
+}
+#pragma pack(push, 8)
+struct XX_THREAD { pthread_t id; bool bRunning; void (*work)(void*); void* arg; };
+#pragma pack(pop)
+static void* threadStart(void* p)
+{
+	XX_THREAD* t = (XX_THREAD*)p;
+	t->work(t->arg);
+	return nullptr;
+}
+void XX_RunThreads(void (*work)(void* arg), void** args, uint16_t n)
+{
+	XX_THREAD* threads = n>1 ? (XX_THREAD*)XX_alloc((uint16_t)(n*sizeof(XX_THREAD))) : nullptr;
+	for(uint16_t i=1; threads && i<n; ++i){
+		threads[i].work = work;
+		threads[i].arg	= args[i];
+		threads[i].bRunning = pthread_create(&threads[i].id, nullptr, threadStart, &threads[i])==0;
+	}
+	if(n) work(args[0]);
+	for(uint16_t i=1; i<n; ++i)
+		if(threads && threads[i].bRunning)	pthread_join(threads[i].id, nullptr);
+		else								work(args[i]);
+	if(threads) XX_free(threads);
+}
+
+#endif
@@ -0,0 +1,310 @@
+//==========================================================================================================================
+//											WALKING A WHOLE TREE
+//==========================================================================================================================
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include "FAT_OS.h"		// <windows.h> or the bits of it we need
+
+#include "FAT_XX.h"
+#include "FAT_YY.h"
+
+//-------------------------------------------------------------------------------------------------
+// Whole card inventories: every folder under the one you give it, what's in each, how big and if
+// you want a CRC32 of every file. It runs a pool of workers, one per core, and each folder is read
+// start to finish by one of them a batch at a time through YY_ReadDirectory(). The folders it finds
+// aren't gone into there and then but queued on that worker's list to be walked later. A worker
+// takes the newest folder off its own list so it goes depth first and when it runs out it steals
+// the oldest one off somebody else's as that is the one with the most tree under it. They all read
+// through the one block cache and the walk is over when no folder is queued or being read. A
+// folder is reported as soon as its last item has been read so the results come out as we go.
+//-------------------------------------------------------------------------------------------------
+#ifndef YY_WALK_DEPTH
+#define YY_WALK_DEPTH	32				// folders deeper than this are counted but not gone into
+#endif
+#ifndef YY_WALK_THREADS
+#define YY_WALK_THREADS	16				// most workers in a walk
+#endif
+#define WALK_BATCH		32				// items per YY_ReadDirectory()
+#define WALK_BUFFER		(32*512)		// file reads for the CRC go straight into this
+
+struct WALKBATCH {						// one per worker so they don't share
+	YY_DIRENTRY	items[WALK_BATCH];
+	uint16_t	names[WALK_BATCH*16];
+};
+struct WALKTASK {						// a folder found but not walked yet
+	WALKTASK*	newer;
+	WALKTASK*	older;
+	uint32_t	startCluster;
+	uint16_t	depth;
+	uint16_t	path[1];				// its longPath, allocated to fit
+};
+// the workers and what they share have locks which want their natural alignment so no packing
+#pragma pack(push, 8)
+struct WALKPOOL;
+struct WALKER {
+	WALKPOOL*	pool;
+	XX_LOCK		lock = XX_LOCK_INIT;	// newest and oldest, taken by thieves too
+	WALKTASK*	newest{};				// the owner's end
+	WALKTASK*	oldest{};				// the thieves' end
+	WALKBATCH*	batch{};
+	uint8_t*	buffer{};				// for the CRCs or nullptr
+	YY_DIRECTORY* first{};				// where the walk starts, just for the first worker
+};
+struct WALKPOOL {
+	uint8_t		rdf;
+	YY_WALKITEM	onItem;
+	YY_WALKDONE	onFolder;
+	void*		user;
+	YY_DRIVE*	drive;
+	WALKER*		workers;
+	uint16_t	nWorkers;
+	XX_LOCK		pendingLock = XX_LOCK_INIT;
+	uint32_t	pending;				// folders queued or being read
+	XX_LOCK		reportLock = XX_LOCK_INIT;	// the callbacks get called one at a time
+	bool		bStopped;				// a callback said no
+};
+#pragma pack(pop)
+
+//-------------------------------------------------------------------------------------------------
+// CRC32 as zip and friends do it (reflected 0xEDB88320) so you can check against other tools
+//-------------------------------------------------------------------------------------------------
+static uint32_t crcTable[256];
+static XX_LOCK	crcLock = XX_LOCK_INIT;		// whoever gets here first builds the table
+
+uint32_t YY_CRC32(uint32_t crc, const void* data, uint32_t count)
+{
+	YY_Lock(&crcLock);
+	if(crcTable[1]==0)
+		for(uint32_t i=0; i<256; ++i){
+			uint32_t c = i;
+			for(int k=0; k<8; ++k)
+				c = (c & 1) ? 0xEDB88320 ^ (c>>1) : c>>1;
+			crcTable[i] = c;
+		}
+	YY_Unlock(&crcLock);
+	const uint8_t* p = (const uint8_t*)data;
+	crc = ~crc;
+	while(count--)
+		crc = crcTable[(crc ^ *p++) & 0xff] ^ (crc>>8);
+	return ~crc;
+}
+static bool fileCRC(YY_DIRECTORY* dir, YY_DIRENTRY* entry, uint8_t* buffer, uint32_t* crc)
+{
+	*crc = 0;
+	YY_FILE* file = YY_DirectoryItemAt(dir, entry);
+	if(file==nullptr) return false;
+	bool ok = YY_OpenFileDirect(file, FOM_READ)!=nullptr;
+	uint32_t n;
+	while(ok && (n = YY_ReadFile(file, buffer, WALK_BUFFER))>0)
+		*crc = YY_CRC32(*crc, buffer, n);
+	ok = ok && YY_TellFile(file)==file->dirn.DIR_FileSize;
+	YY_CloseFile(file);
+	return ok;
+}
+//-------------------------------------------------------------------------------------------------
+// the workers
+//-------------------------------------------------------------------------------------------------
+static bool report(WALKPOOL* pool, YY_DIRECTORY* dir, YY_DIRENTRY* e, uint32_t crc)
+{
+	if(pool->onItem==nullptr) return true;
+	YY_Lock(&pool->reportLock);
+	if(!pool->bStopped && !pool->onItem(dir, e, crc, pool->user)) pool->bStopped = true;
+	bool ok = !pool->bStopped;
+	YY_Unlock(&pool->reportLock);
+	return ok;
+}
+static void reportFolder(WALKPOOL* pool, YY_WALKFOLDER* folder)
+{
+	if(pool->onFolder==nullptr) return;
+	YY_Lock(&pool->reportLock);
+	if(!pool->bStopped && !pool->onFolder(folder, pool->user)) pool->bStopped = true;
+	YY_Unlock(&pool->reportLock);
+}
+static bool running(WALKPOOL* pool)
+{
+	YY_Lock(&pool->reportLock, true);
+	bool ok = !pool->bStopped;
+	YY_Unlock(&pool->reportLock, true);
+	return ok;
+}
+// count folders in and out, the walk is over when it gets back to 0
+static uint32_t pending(WALKPOOL* pool, int8_t change)
+{
+	YY_Lock(&pool->pendingLock);
+	uint32_t n = pool->pending += change;
+	YY_Unlock(&pool->pendingLock);
+	return n;
+}
+static bool queue(WALKER* me, YY_DIRECTORY* dir, YY_DIRENTRY* e, uint16_t depth)
+{
+	uint16_t path[MAX_PATH];
+	memcpy(path, dir->longPath, sizeof path);
+	YY_AddPath(path, e->name);
+	uint16_t len = YY_WideLen(path);
+	WALKTASK* task = (WALKTASK*)XX_alloc((uint16_t)(sizeof(WALKTASK) + len*sizeof(uint16_t)));
+	if(task==nullptr) return false;
+	task->startCluster = ((uint32_t)e->dirn.DIR_FstClusHI<<16) | e->dirn.DIR_FstClusLO;
+	task->depth = depth;
+	memcpy(task->path, path, (len+1)*sizeof(uint16_t));
+	pending(me->pool, 1);
+
+	YY_Lock(&me->lock);
+	task->older = me->newest;
+	task->newer = nullptr;
+	if(me->newest)	me->newest->newer = task;
+	else			me->oldest = task;
+	me->newest = task;
+	YY_Unlock(&me->lock);
+	return true;
+}
+// the newest of ours or failing that the oldest of someone else's
+static WALKTASK* take(WALKER* me)
+{
+	YY_Lock(&me->lock);
+	WALKTASK* task = me->newest;
+	if(task){
+		me->newest = task->older;
+		if(me->newest)	me->newest->newer = nullptr;
+		else			me->oldest = nullptr;
+	}
+	YY_Unlock(&me->lock);
+	WALKPOOL* pool = me->pool;
+	uint16_t n = (uint16_t)(me - pool->workers);
+	for(uint16_t i=1; task==nullptr && i<pool->nWorkers; ++i){
+		WALKER* victim = &pool->workers[(n+i) % pool->nWorkers];
+		YY_Lock(&victim->lock);
+		task = victim->oldest;
+		if(task){
+			victim->oldest = task->newer;
+			if(victim->oldest)	victim->oldest->older = nullptr;
+			else				victim->newest = nullptr;
+		}
+		YY_Unlock(&victim->lock);
+	}
+	return task;
+}
+// read one folder through, queueing the folders in it
+static void walkFolder(WALKER* me, YY_DIRECTORY* dir, uint16_t depth)
+{
+	WALKPOOL* pool = me->pool;
+	YY_WALKFOLDER folder{};
+	folder.path	 = dir->longPath;
+	folder.depth = depth;
+	YY_ResetDirectory(dir);
+	bool ok = true;
+	while(ok){
+		uint16_t got = YY_ReadDirectory(dir, me->batch->items, WALK_BATCH, me->batch->names, _countof(me->batch->names), pool->rdf);
+		if(got==0) break;
+		for(uint16_t i=0; ok && i<got; ++i){
+			YY_DIRENTRY* e = &me->batch->items[i];
+			if(e->dirn.DIR_Attr & ATTR_VOL) continue;		// the volume label isn't an item
+			if(e->dirn.DIR_Attr & ATTR_DIR){
+				++folder.folders;
+				ok = report(pool, dir, e, 0);
+				if(ok && depth+1<YY_WALK_DEPTH && !queue(me, dir, e, depth+1))
+					++folder.errors;
+				continue;
+			}
+			uint32_t crc = 0;
+			if(me->buffer){
+				if(!fileCRC(dir, e, me->buffer, &crc)) ++folder.errors;
+				folder.checksum = YY_CRC32(folder.checksum, &crc, sizeof crc);
+			}
+			++folder.files;
+			folder.bytes += e->dirn.DIR_FileSize;
+			ok = report(pool, dir, e, crc);
+		}
+		if(ok) ok = running(pool);						// or stopped by another worker
+	}
+	if(ok) reportFolder(pool, &folder);
+}
+static void walker(void* arg)
+{
+	WALKER* me = (WALKER*)arg;
+	WALKPOOL* pool = me->pool;
+	if(me->first){
+		walkFolder(me, me->first, 0);
+		me->first = nullptr;
+		pending(pool, -1);
+	}
+	for(;;){
+		WALKTASK* task = take(me);
+		if(task==nullptr){
+			if(pending(pool, 0)==0) break;
+			XX_Yield();						// somebody is still reading a folder that may have more
+			continue;
+		}
+		if(running(pool)){						// once stopped the rest are just thrown away
+			YY_DIRECTORY* dir = YY_OpenDirectoryCluster(pool->drive, task->startCluster, task->path);
+			if(dir){
+				walkFolder(me, dir, task->depth);
+				YY_CloseDirectory(dir);
+			}
+			else{
+				YY_WALKFOLDER folder{};
+				folder.path	  = task->path;
+				folder.depth  = task->depth;
+				folder.errors = 1;
+				reportFolder(pool, &folder);
+			}
+		}
+		XX_free(task);
+		pending(pool, -1);
+	}
+}
+//-------------------------------------------------------------------------------------------------
+// Walk the tree from dir (which you still own) calling onItem for every item and onFolder for each
+// folder when it's done. They are called one at a time but from any of the workers and not in any
+// fixed order. Either can be nullptr and either can return false to stop the walk. nThreads is how
+// many workers, 0 for one per core. The workers run inside your hold of the drive's shared lock.
+// Returns false if stopped.
+//-------------------------------------------------------------------------------------------------
+bool YY_Walk(YY_DIRECTORY* start, uint8_t flags, YY_WALKITEM onItem, YY_WALKDONE onFolder, void* user, uint16_t nThreads)
+{
+#if YY_THREADS
+	if(nThreads==0) nThreads = XX_Cores();
+	if(nThreads>YY_WALK_THREADS) nThreads = YY_WALK_THREADS;
+#endif
+	if(nThreads==0 || !YY_THREADS) nThreads = 1;
+
+	WALKPOOL pool;
+	pool.rdf	  = (flags & (RDF_SHORTNAMES | RDF_NOHIDDEN)) | RDF_NODOTS;
+	pool.onItem	  = onItem;
+	pool.onFolder = onFolder;
+	pool.user	  = user;
+	pool.drive	  = start->drive;
+	pool.pending  = 1;									// the start
+	pool.bStopped = false;
+	pool.nWorkers = nThreads;
+	pool.workers  = (WALKER*)XX_alloc((uint16_t)(nThreads*sizeof(WALKER)));
+	void* args[YY_WALK_THREADS];
+	bool ok = pool.workers!=nullptr;
+	for(uint16_t i=0; ok && i<nThreads; ++i){
+		WALKER* w = &pool.workers[i];
+		*w = WALKER{};
+		w->pool	 = &pool;
+		w->batch = (WALKBATCH*)XX_alloc(sizeof(WALKBATCH));
+		if(flags & WALK_CHECKSUM)
+			w->buffer = (uint8_t*)XX_alloc(WALK_BUFFER);
+		ok = w->batch && (w->buffer || !(flags & WALK_CHECKSUM));
+		args[i] = w;
+		pool.nWorkers = i+1;							// what to free
+	}
+	if(ok){
+		pool.workers[0].first = start;
+#if YY_THREADS
+		XX_RunThreads(walker, args, nThreads);
+#else
+		walker(args[0]);
+#endif
+		ok = !pool.bStopped;
+	}
+	for(uint16_t i=0; pool.workers && i<pool.nWorkers; ++i){
+		if(pool.workers[i].buffer) XX_free(pool.workers[i].buffer);
+		if(pool.workers[i].batch)  XX_free(pool.workers[i].batch);
+	}
+	if(pool.workers) XX_free(pool.workers);
+	return ok;
+}
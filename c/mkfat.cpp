@@ -0,0 +1,153 @@
+//==============================================================================================================
+//			mkfat: MAKE A FAT12/16/32 IMAGE OR DEVICE
+//==============================================================================================================
+
+// mkfat [options] image
+//		-s size		make a new sparse image this big (512 byte sectors or with K, M or G on the end),
+//					without it the image or device must be there already and it all gets used
+//		-t 12|16|32	FAT type, otherwise it goes by the size
+//		-c n		sectors per cluster (a power of two), otherwise the Microsoft defaults
+//		-f n		number of FATs (2)
+//		-r n		root directory entries on FAT12/16 (224 on a floppy, 512 otherwise)
+//		-l label	volume label
+//		-i serial	volume serial number in hex, otherwise from the date and time
+//		-p size		add a partition (up to 4, 0 for the rest of the device) each with its own
+//					file system, otherwise the file system starts at sector 0 like a floppy
+//
+// "mkfat -s 1440K -t 12 floppy.img" is a 1.44M floppy. New images are sparse and YY_Format() only
+// writes the sectors that aren't zeros so even a 32G FAT32 card image is instant and takes no space.
+//
+// On Linux "make" links this with Posix_XX.cpp and the _YY files as a program of its own. On Windows
+// FAT.cpp has main() and the XX_ layer and this is its "FAT mkfat ..." command.
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <cstdlib>
+#include <inttypes.h>
+#include "FAT_OS.h"		// <windows.h> or the bits of it we need
+
+#include "FAT_XX.h"
+#include "FAT_YY.h"
+
+#define PART_ALIGN		2048			// partitions start on 1M boundaries as everyone's do now
+
+// "2880", "1440K", "64M", "4G" into sectors, 0 if it isn't one
+static uint32_t sectors(const char* text)
+{
+	char* end;
+	uint64_t n = strtoull(text, &end, 0);
+	switch(*end){
+	case 'k': case 'K':	n *= 2;				++end; break;
+	case 'm': case 'M':	n *= 2048;			++end; break;
+	case 'g': case 'G':	n *= 2048*1024;		++end; break;
+	}
+	if(*end!=0 || n>0xffffffff) return 0;
+	return (uint32_t)n;
+}
+static void report(const char* name, YY_FORMAT* fmt, uint32_t first)
+{
+	const char* names[] = { "?", "12", "16", "32" };
+	printf("%s: FAT%s at sector %" PRIu32 ", %" PRIu32 " sectors, %" PRIu32 " clusters of %u bytes, "
+			"%u FATs of %" PRIu32 " sectors, data from sector %" PRIu32 ", serial %04X-%04X\n",
+			name, names[fmt->fatType], first, fmt->nSectors, fmt->nClusters, fmt->secPerClus*512,
+			fmt->nFats, fmt->fatSize, first+fmt->dataSector, fmt->volID>>16, fmt->volID & 0xffff);
+}
+int mkfat(int argc, char* argv[])
+{
+	YY_FORMAT base{};
+	uint32_t size = 0, parts[4];
+	uint8_t nParts = 0;
+	const char* name = nullptr;
+	for(int i=0; i<argc; ++i){
+		const char* a = argv[i];
+		if(a[0]!='-' || a[1]==0 || a[2]!=0){
+			name = a;
+			continue;
+		}
+		if(strchr("stcfrlip", a[1])==nullptr){
+			name = nullptr;								// so we show how
+			break;
+		}
+		if(i+1>=argc){
+			printf("%s wants a value\n", a);
+			return -1;
+		}
+		const char* v = argv[++i];
+		switch(a[1]){
+		case 's':	size = sectors(v);									break;
+		case 't':	base.fatType = atoi(v)==12 ? FAT12 : atoi(v)==16 ? FAT16 : atoi(v)==32 ? FAT32 : 0xff;	break;
+		case 'c':	base.secPerClus = (uint8_t)atoi(v);					break;
+		case 'f':	base.nFats = (uint8_t)atoi(v);						break;
+		case 'r':	base.rootEntries = (uint16_t)atoi(v);				break;
+		case 'l':	strncpy(base.label, v, sizeof base.label-1);		break;
+		case 'i':	base.volID = (uint32_t)strtoul(v, nullptr, 16);		break;
+		case 'p':
+			if(nParts==4){
+				printf("Four partitions is all an MBR has\n");
+				return -1;
+			}
+			parts[nParts++] = strcmp(v, "0")==0 ? 0 : sectors(v) ? sectors(v) : 0xffffffff;
+			break;
+		}
+	}
+	if(name==nullptr || base.fatType==0xff){
+		printf("mkfat [-s size] [-t 12|16|32] [-c sectors/cluster] [-f FATs] [-r root entries]\n"
+			   "      [-l label] [-i serial] [-p size]... image\n");
+		return -1;
+	}
+
+	if(size){
+		if(!XX_CreateImage(name, size)){
+			printf("Can't make %s\n", name);
+			error();
+			return 1;
+		}
+		base.flags |= FMT_ZEROED;
+	}
+	HANDLE hDevice = XX_OpenDevice(name);
+	if(hDevice==INVALID_HANDLE_VALUE){
+		printf("Can't open %s\n", name);
+		error();
+		return 1;
+	}
+	uint32_t nSectors = size ? size : XX_DeviceSectors(hDevice);
+
+	bool ok = true;
+	if(nParts==0){
+		YY_FORMAT fmt = base;
+		fmt.nSectors = nSectors;
+		ok = YY_Format(hDevice, 0, &fmt);
+		if(ok) report(name, &fmt, 0);
+	}
+	else{
+		BOOT_SECTOR::PARTITION table[4]{};
+		uint32_t next = PART_ALIGN;
+		for(uint8_t i=0; ok && i<nParts; ++i){
+			uint32_t count = parts[i] ? parts[i] : nSectors>next ? nSectors-next : 0;
+			if(count==0xffffffff || count==0 || next>=nSectors || count>nSectors-next){
+				printf("Partition %u doesn't fit\n", i+1);
+				ok = false;
+				break;
+			}
+			YY_FORMAT fmt = base;
+			fmt.nSectors = count;
+			ok = YY_Format(hDevice, next, &fmt);
+			if(!ok) break;
+			report(name, &fmt, next);
+			table[i].LBA_Begin = next;
+			table[i].nSectors  = count;
+			table[i].Type_Code = YY_PartitionType(fmt.fatType, count);
+			next = (uint32_t)(((uint64_t)next+count+PART_ALIGN-1)/PART_ALIGN*PART_ALIGN);
+		}
+		ok = ok && YY_WritePartitions(hDevice, table, nParts);
+	}
+	XX_CloseDevice(hDevice);
+	return ok ? 0 : 1;
+}
+#if !defined(_WIN32)
+int main(int argc, char* argv[])
+{
+	return mkfat(argc-1, argv+1);
+}
+#endif
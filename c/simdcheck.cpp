@@ -0,0 +1,55 @@
+//==============================================================================================================
+//			simdcheck: THE FAT SCAN KERNELS AGAINST WHAT THEY ARE MEANT TO DO
+//==============================================================================================================
+
+// MatchBits32() and MatchBits16() in Clusters_YY.cpp come in AVX2, SSE2 and plain loop versions
+// depending on what the compiler is targeting (and YY_SIMD). This puts random FAT entries through
+// whichever one got built and checks every bit against the definition: bit n is set if entry n
+// matches the value, ignoring the top four bits of a FAT32 entry. The entries are mostly free, bad
+// or the value with junk in the top bits and half the time start off the 4 byte boundary as the
+// FAT buffers do. "make check" builds and runs it so check all three with:
+//		make clean check CXXFLAGS='-O2 -mavx2'		make clean check		make clean check CPPFLAGS=-DYY_SIMD=0
+// It takes Clusters_YY.cpp in whole to get at the static kernels so it links with the other _YY
+// files and the XX_ layer but not Clusters_YY.cpp.
+
+#include "Clusters_YY.cpp"
+#include <cstdlib>
+
+#define N_TRIES		200000
+
+int main()
+{
+#if defined(SIMD_AVX2)
+	const char* kernel = "AVX2";
+#elif defined(SIMD_SSE2)
+	const char* kernel = "SSE2";
+#else
+	const char* kernel = "scalar";
+#endif
+	srand(1);
+	uint32_t bad32 = 0, bad16 = 0;
+	for(uint32_t k=0; k<N_TRIES; ++k){
+		uint32_t a[33];
+		uint16_t b[33];
+		uint32_t v32 = rand()%3==0 ? 0x0ffffff7 : 0;				// bad cluster or free
+		uint16_t v16 = rand()%3==0 ? 0xfff7 : 0;
+		for(int i=0; i<33; ++i){
+			switch(rand()%4){
+			case 0:		a[i] = 0;					b[i] = 0;				break;
+			case 1:		a[i] = 0xf0000000 | v32;	b[i] = v16;				break;	// reserved bits set
+			case 2:		a[i] = v32;					b[i] = (uint16_t)rand();	break;
+			default:	a[i] = (uint32_t)rand();	b[i] = (uint16_t)rand();	break;
+			}
+		}
+		int off = k & 1;											// unaligned half the time
+		uint32_t want32 = 0, want16 = 0;
+		for(int i=0; i<32; ++i){
+			if((a[i+off] & 0x0fffffff)==v32) want32 |= 1u<<i;
+			if(b[i+off]==v16)				 want16 |= 1u<<i;
+		}
+		if(MatchBits32(a+off, v32)!=want32) ++bad32;
+		if(MatchBits16(b+off, v16)!=want16) ++bad16;
+	}
+	printf("%s kernels, %u tries: MatchBits32 %u wrong, MatchBits16 %u wrong\n", kernel, N_TRIES, bad32, bad16);
+	return bad32 || bad16 ? 1 : 0;
+}